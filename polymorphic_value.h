@@ -21,15 +21,153 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef ISOCPP_P0201_POLYMORPHIC_VALUE_H_INCLUDED
 #define ISOCPP_P0201_POLYMORPHIC_VALUE_H_INCLUDED
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
+#include <functional>
 #include <memory>
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+#include <new>
 #include <type_traits>
 #include <typeinfo>
 #include <utility>
 
+// Define `ISOCPP_P0201_POLYMORPHIC_VALUE_NO_MEMORY_MAPPING` to keep
+// `polymorphic_value` from mapping memory itself, and from including the
+// system headers that it needs to, on Linux. Large objects are then allocated
+// like other objects, and `monotonic_arena` does not use huge pages.
+#if defined(__linux__) && \
+    !defined(ISOCPP_P0201_POLYMORPHIC_VALUE_NO_MEMORY_MAPPING)
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_MEMORY_MAPPING 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// `polymorphic_value` can be used in constant expressions when C++20
+// constexpr allocation is available.
+#if defined(__cpp_constexpr_dynamic_alloc) && \
+    defined(__cpp_lib_is_constant_evaluated)
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR constexpr
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_CONSTEXPR 1
+#else
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR
+#endif
+
+// `polymorphic_value` is allocator-aware, with
+// `std::pmr::polymorphic_allocator` as its `allocator_type`, when
+// `<memory_resource>` is available.
+#if defined(__cpp_lib_memory_resource)
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_PMR 1
+#endif
+
+// Define `ISOCPP_P0201_POLYMORPHIC_VALUE_ALLOCATION_RESOURCE` to route the
+// storage that `polymorphic_value` allocates without an allocator through the
+// memory resource set by `set_allocation_resource`. Each such allocation then
+// records the resource it came from.
+#if defined(ISOCPP_P0201_POLYMORPHIC_VALUE_ALLOCATION_RESOURCE) && \
+    defined(ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_PMR)
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_ALLOCATION_RESOURCE 1
+#endif
+
+// Define `ISOCPP_P0201_POLYMORPHIC_VALUE_NO_EXCEPTIONS` to use
+// `polymorphic_value` without exceptions. It is defined when exceptions are
+// disabled. Construction from a pointer whose dynamic type does not match its
+// static type then leaves the value empty, and the pointer owned by the caller,
+// instead of throwing `bad_polymorphic_value_construction`.
+#if !defined(ISOCPP_P0201_POLYMORPHIC_VALUE_NO_EXCEPTIONS) && \
+    !defined(__cpp_exceptions) && !defined(_CPPUNWIND)
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_NO_EXCEPTIONS
+#endif
+
+// Objects of types that specialize `uses_large_object_storage` are placed in
+// memory files that their copies map copy-on-write, where memory files are
+// available.
+#if defined(ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_MEMORY_MAPPING) && \
+    defined(MFD_CLOEXEC)
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_LARGE_OBJECTS 1
+#endif
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_NO_EXCEPTIONS
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_TRY if (true)
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_CATCH_ALL else
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_CATCH_BAD_ALLOC else
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_RETHROW
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTRUCTION_ERROR return
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_THROW(e) std::abort()
+#else
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_TRY try
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_CATCH_ALL catch (...)
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_CATCH_BAD_ALLOC \
+  catch (const std::bad_alloc&)
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_RETHROW throw
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTRUCTION_ERROR \
+  throw bad_polymorphic_value_construction()
+#define ISOCPP_P0201_POLYMORPHIC_VALUE_THROW(e) throw e
+#endif
+
 namespace isocpp_p0201 {
 
+// Specialize to give objects of type `U` a small non-zero tag, less than
+// `max_type_tag`, that `polymorphic_value` stores in spare bits of its
+// control block pointer. Type tests on the tag do not need to dereference the
+// owned object.
+template <class U>
+struct type_tag : std::integral_constant<std::size_t, 0> {};
+
+template <class U>
+inline constexpr std::size_t type_tag_v = type_tag<U>::value;
+
+// Specialize as `std::true_type` to recycle the control blocks of objects of
+// type `U` through `control_block_pool` instead of releasing them. Define
+// `ISOCPP_P0201_POLYMORPHIC_VALUE_POOL_CONTROL_BLOCKS` to pool the control
+// blocks of all types unless specialized otherwise.
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_POOL_CONTROL_BLOCKS
+template <class U>
+struct uses_control_block_pool : std::true_type {};
+#else
+template <class U>
+struct uses_control_block_pool : std::false_type {};
+#endif
+
+// Specialize as `std::true_type` to place objects of type `U` created in
+// place or by `make_polymorphic_value` in page-aligned mappings of their own
+// memory file, where supported. Copies map the same file privately, sharing
+// its pages copy-on-write, so that copying takes time proportional to the
+// pages written since rather than to the size of the object. `U` must be
+// copyable bytewise, as a trivially copyable type is, apart from its vtable
+// pointer. Each such value holds an open file descriptor.
+template <class U>
+struct uses_large_object_storage : std::false_type {};
+
+template <class T>
+struct default_copy;
+
+// Memory owned by a `polymorphic_value`, as reported by `memory_footprint`.
+struct value_footprint {
+  // Size and alignment of the dynamic type of the owned object.
+  std::size_t object_size = 0;
+  std::size_t object_alignment = 0;
+  // Bytes of the control block other than the object, including the header
+  // of its allocation.
+  std::size_t control_block_size = 0;
+  // Bytes requested for the object and control block, including rounding to
+  // a pool size class or, for large objects, to whole pages.
+  std::size_t allocated = 0;
+  // Bytes reported by the object's `dynamic_memory_footprint()`, in
+  // recursive mode.
+  std::size_t nested = 0;
+
+  std::size_t total() const noexcept { return allocated + nested; }
+};
+
 namespace detail {
 
 ////////////////////////////////////////////////////////////////////////////
@@ -49,223 +187,3344 @@ struct copier_traits_deleter_base<U* (*)(V)> {
   using deleter_type = void (*)(U*);
 };
 
+template <class U, class = void>
+struct has_dynamic_memory_footprint : std::false_type {};
+
+template <class U>
+struct has_dynamic_memory_footprint<
+    U,
+    std::void_t<decltype(std::declval<const U&>().dynamic_memory_footprint())>>
+    : std::true_type {};
+
+// Bytes owned by `u` outside its own storage, if its type reports them.
+template <class U>
+std::size_t dynamic_memory_footprint(const U& u) {
+  if constexpr (has_dynamic_memory_footprint<U>::value) {
+    return u.dynamic_memory_footprint();
+  } else {
+    return 0;
+  }
+}
+
+// A copier `C` for objects of type `U` may also provide
+//
+//   U* copy_into(const U& u, void* storage) const;
+//
+// constructing a copy of `u` in `storage`, which has the size and alignment
+// of `U`. Copies of values adopted with such a copier are then made with
+// `copy_into` into the storage of their control block, in one allocation,
+// and are destroyed without the deleter.
+template <class C, class U, class = void>
+struct copies_into : std::false_type {};
+
+template <class C, class U>
+struct copies_into<C, U,
+                   std::void_t<decltype(std::declval<const C&>().copy_into(
+                       std::declval<const U&>(), std::declval<void*>()))>>
+    : std::true_type {};
+
+// Copies made with `default_copy` need not be released with `delete`, so
+// values adopted with it and the default deleter are copied into blocks that
+// hold the object directly.
+template <class U, class C, class D>
+struct copies_directly
+    : std::bool_constant<std::is_same<C, default_copy<U>>::value &&
+                         std::is_same<D, std::default_delete<U>>::value> {};
+
 class control_block_deleter {
  public:
   template <class T>
-  void operator()(T* t) const noexcept {
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR void operator()(
+      T* t) const noexcept {
     if (t != nullptr) {
       t->destroy();
     }
   }
 };
 
+class control_block;
+
+using control_block_ptr = std::unique_ptr<control_block, control_block_deleter>;
+
+// Operations on a control block. Each control block type has a single
+// constant table of operations which is used in place of a vtable.
+//
+// Control blocks depend only on the type of the owned object and not on the
+// base type of the `polymorphic_value` that owns them. The handle stores a
+// pointer to its base subobject and rebases it onto copies of the object.
+struct control_block_ops {
+  control_block* (*clone)(const control_block&);
+  control_block* (*try_clone)(const control_block&);
+  control_block* (*clone_into)(const control_block&, void*);
+  control_block* (*move_into)(control_block&, void*);
+  void* (*object)(control_block&) noexcept;
+  void* (*allocate)();
+  void* (*try_allocate)() noexcept;
+  void (*destroy)(control_block&) noexcept;
+  void (*destroy_in_place)(control_block&) noexcept;
+  std::size_t size;
+  std::size_t alignment;
+  std::size_t type_tag;
+  bool trivially_copyable;
+  // Copy-assigns the owned object from that of a block of the same type, or
+  // null if that is not possible without throwing.
+  void (*assign)(control_block&, const control_block&) noexcept;
+  value_footprint (*footprint)(const control_block&, bool recursive);
+  // Size of the storage the block was allocated in, or zero if it was not
+  // allocated by `control_block_storage`.
+  std::size_t storage_size;
+  bool pooled;
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_PMR
+  control_block* (*clone_to)(const control_block&, std::pmr::memory_resource*);
+  std::pmr::memory_resource* (*resource)(const control_block&) noexcept;
+#endif
+};
+
+// Allocates storage as a new-expression would.
+inline void* allocate_bytes(std::size_t size, std::size_t alignment) {
+  if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+    return ::operator new(size, std::align_val_t(alignment));
+  }
+  return ::operator new(size);
+}
+
+inline void* allocate_bytes(std::size_t size, std::size_t alignment,
+                            const std::nothrow_t&) noexcept {
+  if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+    return ::operator new(size, std::align_val_t(alignment), std::nothrow);
+  }
+  return ::operator new(size, std::nothrow);
+}
+
+inline void deallocate_bytes(void* p, std::size_t alignment) noexcept {
+  if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+    ::operator delete(p, std::align_val_t(alignment));
+  } else {
+    ::operator delete(p);
+  }
+}
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_ALLOCATION_RESOURCE
+// The resource set by `set_allocation_resource`, or null for global operator
+// new.
+inline std::atomic<std::pmr::memory_resource*> allocation_resource{nullptr};
+
+// Records the resource that storage for a control block was allocated from,
+// or null for global operator new, and the size of the allocation, so that
+// the storage is released there even if another resource has been set since.
+// It immediately precedes the storage.
+struct allocation_header {
+  std::pmr::memory_resource* resource;
+  std::size_t size;
+};
+
+static_assert(sizeof(allocation_header) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+              "");
+
+inline const allocation_header& allocation_header_of(
+    const void* storage) noexcept {
+  return *std::launder(reinterpret_cast<const allocation_header*>(
+      static_cast<const unsigned char*>(storage) - sizeof(allocation_header)));
+}
+
+inline void* record_allocation(void* p, std::pmr::memory_resource* r,
+                               std::size_t size, std::size_t header) noexcept {
+  auto* storage = static_cast<unsigned char*>(p) + header;
+  ::new (storage - sizeof(allocation_header)) allocation_header{r, size};
+  return storage;
+}
+#endif
+
+// Bytes allocated before storage for a control block with `alignment`.
+constexpr std::size_t allocation_header_size(std::size_t alignment) noexcept {
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_ALLOCATION_RESOURCE
+  return std::max(alignment, std::size_t(__STDCPP_DEFAULT_NEW_ALIGNMENT__));
+#else
+  (void)alignment;
+  return 0;
+#endif
+}
+
+// Allocates storage for a control block from the allocation resource, or as
+// a new-expression would if none is set.
+inline void* allocate_control_block(std::size_t size, std::size_t alignment) {
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_ALLOCATION_RESOURCE
+  const auto header = allocation_header_size(alignment);
+  auto* r = allocation_resource.load(std::memory_order_acquire);
+  void* p = r ? r->allocate(header + size, header)
+              : allocate_bytes(header + size, alignment);
+  return record_allocation(p, r, header + size, header);
+#else
+  return allocate_bytes(size, alignment);
+#endif
+}
+
+// As `allocate_control_block`, but returns null on failure.
+inline void* allocate_control_block(std::size_t size, std::size_t alignment,
+                                    const std::nothrow_t&) noexcept {
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_ALLOCATION_RESOURCE
+  const auto header = allocation_header_size(alignment);
+  auto* r = allocation_resource.load(std::memory_order_acquire);
+  void* p = nullptr;
+  if (r) {
+    ISOCPP_P0201_POLYMORPHIC_VALUE_TRY {
+      p = r->allocate(header + size, header);
+    }
+    ISOCPP_P0201_POLYMORPHIC_VALUE_CATCH_ALL {}
+  } else {
+    p = allocate_bytes(header + size, alignment, std::nothrow);
+  }
+  return p ? record_allocation(p, r, header + size, header) : nullptr;
+#else
+  return allocate_bytes(size, alignment, std::nothrow);
+#endif
+}
+
+// Releases storage from `allocate_control_block` with the same `alignment`
+// to where it was allocated from.
+inline void deallocate_control_block(void* p, std::size_t alignment) noexcept {
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_ALLOCATION_RESOURCE
+  const auto header = allocation_header_size(alignment);
+  const auto h = allocation_header_of(p);
+  p = static_cast<unsigned char*>(p) - header;
+  if (h.resource) {
+    h.resource->deallocate(p, h.size, header);
+    return;
+  }
+#endif
+  deallocate_bytes(p, alignment);
+}
+
+class control_block {
+  const control_block_ops* ops_;
+
+ protected:
+  constexpr explicit control_block(const control_block_ops* ops) noexcept
+      : ops_(ops) {}
+
+  control_block(const control_block&) = default;
+
+  ~control_block() = default;
+
+ public:
+  // Heap-allocates a copy of this control block. Trivially copyable control
+  // blocks are copied bytewise.
+  control_block* clone() const {
+    if (ops_->trivially_copyable) {
+      return copy_bytes_into(ops_->allocate());
+    }
+    return ops_->clone(*this);
+  }
+
+  // As `clone`, but returns null if storage for the copy cannot be allocated.
+  control_block* try_clone() const {
+    if (ops_->trivially_copyable) {
+      void* storage = ops_->try_allocate();
+      return storage ? copy_bytes_into(storage) : nullptr;
+    }
+    return ops_->try_clone(*this);
+  }
+
+  // Copy-constructs this control block into `storage`, which must be
+  // suitably sized and aligned for the dynamic type of the control block.
+  control_block* clone_into(void* storage) const {
+    if (ops_->trivially_copyable) {
+      return copy_bytes_into(storage);
+    }
+    return ops_->clone_into(*this, storage);
+  }
+
+  // Move-constructs this control block into `storage`. Used to relocate
+  // control blocks held in inline storage.
+  control_block* move_into(void* storage) {
+    return ops_->move_into(*this, storage);
+  }
+
+  // The owned object, or null if there is none.
+  void* object() noexcept { return ops_->object(*this); }
+
+  // Size and alignment of the storage required by `clone_into`.
+  std::size_t size() const noexcept { return ops_->size; }
+
+  std::size_t alignment() const noexcept { return ops_->alignment; }
+
+  // The `type_tag` of the owned object type.
+  constexpr std::size_t type_tag() const noexcept { return ops_->type_tag; }
+
+  // Copy-assigns the owned object from that of `b` and returns true if both
+  // blocks have the same type and it can be assigned without throwing.
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR bool assign(
+      const control_block& b) noexcept {
+    if (ops_ != b.ops_ || !ops_->assign) {
+      return false;
+    }
+    ops_->assign(*this, b);
+    return true;
+  }
+
+  // Memory owned by this block, including that reported by the owned object
+  // if `recursive` is true.
+  value_footprint footprint(bool recursive) const {
+    return ops_->footprint(*this, recursive);
+  }
+
+  // Size of the storage this block was allocated in, or zero if it was not
+  // allocated by `control_block_storage`, and whether it is pooled.
+  std::size_t storage_size() const noexcept { return ops_->storage_size; }
+
+  bool pooled() const noexcept { return ops_->pooled; }
+
+  // Destroys this control block and releases its storage.
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR void destroy() noexcept {
+    ops_->destroy(*this);
+  }
+
+  // Destroys this control block without releasing its storage.
+  void destroy_in_place() noexcept { ops_->destroy_in_place(*this); }
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_PMR
+  // Copies the owned object into memory from `r`, where the control block
+  // type allows it, and otherwise as `clone` does.
+  control_block* clone_to(std::pmr::memory_resource* r) const {
+    return ops_->clone_to(*this, r);
+  }
+
+  // The memory resource that holds the owned object, or null if it was
+  // allocated by an allocator other than `std::pmr::polymorphic_allocator` or
+  // `std::allocator`.
+  std::pmr::memory_resource* resource() const noexcept {
+    return ops_->resource(*this);
+  }
+#endif
+
+ private:
+  control_block* copy_bytes_into(void* storage) const noexcept {
+    std::memcpy(storage, this, size());
+    return std::launder(static_cast<control_block*>(storage));
+  }
+};
+
+// Offset in bytes of the subobject `p` from the object owned by `cb`.
+template <class T>
+std::ptrdiff_t subobject_offset(const T* p, control_block& cb) noexcept {
+  return reinterpret_cast<const char*>(p) -
+         static_cast<const char*>(cb.object());
+}
+
+// The subobject at `offset` bytes from the object owned by `cb`, or null if
+// `cb` owns no object.
 template <class T>
-struct control_block {
-  virtual ~control_block() = default;
+T* subobject_at(control_block& cb, std::ptrdiff_t offset) noexcept {
+  auto* object = static_cast<char*>(cb.object());
+  return object ? reinterpret_cast<T*>(object + offset) : nullptr;
+}
+
+struct free_block {
+  free_block* next;
+};
+
+inline void release_free_blocks(free_block* p) noexcept {
+  while (p) {
+    auto* b = std::exchange(p, p->next);
+    deallocate_control_block(b, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+  }
+}
+
+// Free control blocks of one size class, shared by all threads. Threads
+// return lists of blocks with a lock-free push and take every block at once,
+// so that no block is popped while another thread may reuse it.
+class size_class_pool {
+  alignas(64) std::atomic<free_block*> free_{nullptr};
+
+ public:
+  ~size_class_pool() { trim(); }
+
+  void push(free_block* first, free_block* last) noexcept {
+    last->next = free_.load(std::memory_order_relaxed);
+    while (!free_.compare_exchange_weak(last->next, first,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed)) {
+    }
+  }
+
+  free_block* take() noexcept {
+    return free_.exchange(nullptr, std::memory_order_acquire);
+  }
+
+  void reserve(std::size_t size, std::size_t n) {
+    for (; n > 0; --n) {
+      auto* b = ::new (allocate_control_block(
+          size, __STDCPP_DEFAULT_NEW_ALIGNMENT__)) free_block{nullptr};
+      push(b, b);
+    }
+  }
+
+  void trim() noexcept { release_free_blocks(take()); }
+};
+
+inline constexpr std::size_t pool_granularity = 16;
+inline constexpr std::size_t max_pooled_size = 512;
+inline constexpr std::size_t size_class_count =
+    max_pooled_size / pool_granularity;
+
+inline size_class_pool size_class_pools[size_class_count];
+
+// Free control blocks cached by one thread, which are used without
+// synchronization. Blocks freed by a thread go to its own cache, wherever
+// they were allocated; a cache that grows past `max_cached` blocks of a size
+// class, or whose thread exits, returns them to the shared pool.
+class thread_cache {
+ public:
+  static constexpr std::size_t max_cached = 256;
+
+ private:
+  struct list {
+    free_block* first = nullptr;
+    std::size_t count = 0;
+  };
+
+  list lists_[size_class_count];
+
+  static void flush(list& l, std::size_t size_class) noexcept {
+    if (!l.first) {
+      return;
+    }
+    auto* last = l.first;
+    while (last->next) {
+      last = last->next;
+    }
+    size_class_pools[size_class].push(l.first, last);
+    l = list{};
+  }
+
+ public:
+  ~thread_cache();
+
+  void* allocate(std::size_t size_class) noexcept {
+    auto& l = lists_[size_class];
+    if (!l.first) {
+      l.first = size_class_pools[size_class].take();
+      if (!l.first) {
+        return nullptr;
+      }
+      // Keep at most `max_cached` of the shared blocks and return the rest.
+      auto* last = l.first;
+      for (l.count = 1; last->next && l.count < max_cached; ++l.count) {
+        last = last->next;
+      }
+      if (auto* rest = std::exchange(last->next, nullptr)) {
+        auto* rest_last = rest;
+        while (rest_last->next) {
+          rest_last = rest_last->next;
+        }
+        size_class_pools[size_class].push(rest, rest_last);
+      }
+    }
+    --l.count;
+    return std::exchange(l.first, l.first->next);
+  }
+
+  void deallocate(void* p, std::size_t size_class) noexcept {
+    auto& l = lists_[size_class];
+    l.first = ::new (p) free_block{l.first};
+    if (++l.count > max_cached) {
+      flush(l, size_class);
+    }
+  }
+
+  void trim() noexcept {
+    for (auto& l : lists_) {
+      release_free_blocks(std::exchange(l, list{}).first);
+    }
+  }
+};
+
+inline thread_local bool thread_cache_destroyed = false;
+
+// The cache of the calling thread, or null once it has been destroyed during
+// thread exit.
+inline thread_cache* local_thread_cache() noexcept {
+  if (thread_cache_destroyed) {
+    return nullptr;
+  }
+  static thread_local thread_cache cache;
+  return &cache;
+}
+
+inline thread_cache::~thread_cache() {
+  for (std::size_t i = 0; i < size_class_count; ++i) {
+    flush(lists_[i], i);
+  }
+  thread_cache_destroyed = true;
+}
+
+// A free block of `size_class`, or null if there is none.
+inline void* allocate_pooled(std::size_t size_class) noexcept {
+  if (auto* cache = local_thread_cache()) {
+    return cache->allocate(size_class);
+  }
+  return nullptr;
+}
+
+inline void deallocate_pooled(void* p, std::size_t size_class) noexcept {
+  if (auto* cache = local_thread_cache()) {
+    cache->deallocate(p, size_class);
+  } else {
+    auto* b = ::new (p) free_block{nullptr};
+    size_class_pools[size_class].push(b, b);
+  }
+}
+
+template <class B>
+using control_block_object_t = std::remove_cv_t<
+    std::remove_pointer_t<decltype(std::declval<B&>().ptr())>>;
+
+// Storage for heap-allocated control blocks of type `B`.
+template <class B>
+struct control_block_storage {
+  static constexpr bool pooled =
+      uses_control_block_pool<control_block_object_t<B>>::value &&
+      sizeof(B) <= max_pooled_size &&
+      alignof(B) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+  static constexpr std::size_t size_class = (sizeof(B) - 1) / pool_granularity;
+  static constexpr std::size_t pooled_size =
+      (size_class + 1) * pool_granularity;
+
+  static void* allocate() {
+    if constexpr (pooled) {
+      void* p = allocate_pooled(size_class);
+      return p ? p
+               : allocate_control_block(pooled_size,
+                                        __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    } else {
+      return allocate_control_block(sizeof(B), alignof(B));
+    }
+  }
+
+  static void* try_allocate() noexcept {
+    if constexpr (pooled) {
+      void* p = allocate_pooled(size_class);
+      return p ? p
+               : allocate_control_block(pooled_size,
+                                        __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+                                        std::nothrow);
+    } else {
+      return allocate_control_block(sizeof(B), alignof(B), std::nothrow);
+    }
+  }
+
+  static void deallocate(void* p) noexcept {
+    if constexpr (pooled) {
+      deallocate_pooled(p, size_class);
+    } else {
+      deallocate_control_block(p, alignof(B));
+    }
+  }
+
+  // Whether the storage of `b` can hold a `B` and be released as if it had
+  // been allocated for one.
+  static bool can_reuse(const control_block& b) noexcept {
+    if (b.storage_size() == 0 || b.pooled() != pooled) {
+      return false;
+    }
+    if constexpr (pooled) {
+      return b.storage_size() == pooled_size;
+    } else {
+      constexpr auto new_alignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+      if (b.alignment() != alignof(B) &&
+          (b.alignment() > new_alignment || alignof(B) > new_alignment)) {
+        return false;
+      }
+      return sizeof(B) <= b.storage_size();
+    }
+  }
+};
+
+template <class U, class A>
+class allocated_direct_control_block;
+
+template <class U, class A, class... Ts>
+allocated_direct_control_block<U, A>* allocate_direct_control_block(
+    const A& a, Ts&&... ts);
+
+// Base class for control blocks of type `B`. `B` must provide `clone`,
+// `clone_into` and `ptr`, and may replace the defaults for the remaining
+// operations.
+template <class B>
+class control_block_impl : public control_block {
+  static control_block* clone_op(const control_block& b) {
+    return static_cast<const B&>(b).clone();
+  }
+
+  static control_block* try_clone_op(const control_block& b) {
+    return static_cast<const B&>(b).try_clone();
+  }
+
+  static control_block* clone_into_op(const control_block& b, void* storage) {
+    return static_cast<const B&>(b).clone_into(storage);
+  }
+
+  static control_block* move_into_op(control_block& b, void* storage) {
+    return static_cast<B&>(b).move_into(storage);
+  }
+
+  static void* object_op(control_block& b) noexcept {
+    return const_cast<void*>(
+        static_cast<const void*>(static_cast<B&>(b).ptr()));
+  }
+
+  static void* allocate_op() { return control_block_storage<B>::allocate(); }
+
+  static void* try_allocate_op() noexcept {
+    return control_block_storage<B>::try_allocate();
+  }
+
+  static void destroy_op(control_block& b) noexcept {
+    static_cast<B&>(b).destroy();
+  }
+
+  static void destroy_in_place_op(control_block& b) noexcept {
+    static_cast<B&>(b).~B();
+  }
+
+  static void assign_op(control_block& b, const control_block& from) noexcept {
+    using U = control_block_object_t<B>;
+    *static_cast<U*>(object_op(b)) =
+        *static_cast<const U*>(object_op(const_cast<control_block&>(from)));
+  }
+
+  static constexpr auto assign_fn() noexcept {
+    using stored_type =
+        std::remove_pointer_t<decltype(std::declval<B&>().ptr())>;
+    using fn = void (*)(control_block&, const control_block&) noexcept;
+    if constexpr (B::holds_exact_type &&
+                  std::is_nothrow_copy_assignable<stored_type>::value) {
+      return fn(&assign_op);
+    } else {
+      return fn(nullptr);
+    }
+  }
+
+  static value_footprint footprint_op(const control_block& b, bool recursive) {
+    using U = control_block_object_t<B>;
+    auto& block = const_cast<control_block&>(b);
+    const auto* u = static_cast<const U*>(object_op(block));
+    value_footprint f;
+    if (!u) {
+      return f;
+    }
+    f.object_size = sizeof(U);
+    f.object_alignment = alignof(U);
+    f.allocated = static_cast<const B&>(b).allocated_size();
+    std::less<const void*> less;
+    const auto* begin = reinterpret_cast<const unsigned char*>(&b);
+    if (!less(u, begin) && less(u, begin + sizeof(B))) {
+      f.control_block_size = sizeof(B) - sizeof(U) + header_size();
+    } else {
+      f.control_block_size = sizeof(B) + header_size();
+      f.allocated += sizeof(U);
+    }
+    if (recursive) {
+      f.nested = dynamic_memory_footprint(*u);
+    }
+    return f;
+  }
+
+  // Bytes allocated for the block, which blocks with storage of their own
+  // override.
+  std::size_t allocated_size() const noexcept {
+    return (storage_size() ? storage_size() : sizeof(B)) + header_size();
+  }
+
+  // Bytes of the allocation header before storage of the block.
+  static constexpr std::size_t header_size() noexcept {
+    if constexpr (B::uses_control_block_storage) {
+      return allocation_header_size(alignof(B));
+    } else {
+      return 0;
+    }
+  }
+
+  static constexpr std::size_t storage_size() noexcept {
+    if constexpr (!B::uses_control_block_storage) {
+      return 0;
+    } else if constexpr (control_block_storage<B>::pooled) {
+      return control_block_storage<B>::pooled_size;
+    } else {
+      return sizeof(B);
+    }
+  }
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_PMR
+  static control_block* clone_to_op(const control_block& b,
+                                    std::pmr::memory_resource* r) {
+    return static_cast<const B&>(b).clone_to(r);
+  }
+
+  static std::pmr::memory_resource* resource_op(
+      const control_block& b) noexcept {
+    return static_cast<const B&>(b).resource();
+  }
+#endif
+
+  static constexpr std::size_t object_type_tag() noexcept {
+    using U = control_block_object_t<B>;
+    static_assert(type_tag_v<U> < alignof(control_block),
+                  "type_tag must be less than max_type_tag");
+    return type_tag_v<U>;
+  }
+
+  static constexpr control_block_ops ops = {
+      &clone_op, &try_clone_op, &clone_into_op, &move_into_op, &object_op,
+      &allocate_op, &try_allocate_op, &destroy_op, &destroy_in_place_op,
+      sizeof(B), alignof(B), object_type_tag(),
+      std::is_trivially_copyable<B>::value, assign_fn(), &footprint_op,
+      storage_size(),
+      B::uses_control_block_storage && control_block_storage<B>::pooled,
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_PMR
+      &clone_to_op, &resource_op,
+#endif
+  };
+
+ protected:
+  control_block_impl() noexcept : control_block(&ops) {}
+
+ public:
+  control_block* clone() const = delete;
+  control_block* clone_into(void* storage) const = delete;
+  void ptr() noexcept = delete;
 
-  virtual std::unique_ptr<control_block, control_block_deleter> clone()
-      const = 0;
+  // Whether the owned object is known to be exactly of the type `ptr` points
+  // to, so that it can be copy-assigned from another block of type `B`.
+  static constexpr bool holds_exact_type = false;
 
-  virtual T* ptr() = 0;
+  // Whether blocks are allocated by `create` and released by `destroy` with
+  // `control_block_storage<B>`.
+  static constexpr bool uses_control_block_storage = true;
 
-  virtual void destroy() noexcept { delete this; }
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_PMR
+  control_block* clone_to(std::pmr::memory_resource*) const {
+    return static_cast<const B&>(*this).clone();
+  }
+
+  std::pmr::memory_resource* resource() const noexcept {
+    return std::pmr::new_delete_resource();
+  }
+#endif
+
+  // Heap-allocates a control block of type `B`, which `destroy` releases.
+  template <class... Ts>
+  static B* create(Ts&&... ts) {
+    void* storage = control_block_storage<B>::allocate();
+    B* b = nullptr;
+    ISOCPP_P0201_POLYMORPHIC_VALUE_TRY {
+      b = ::new (storage) B(std::forward<Ts>(ts)...);
+    }
+    ISOCPP_P0201_POLYMORPHIC_VALUE_CATCH_ALL {
+      control_block_storage<B>::deallocate(storage);
+      ISOCPP_P0201_POLYMORPHIC_VALUE_RETHROW;
+    }
+    return b;
+  }
+
+  // As `create`, but returns null if storage cannot be allocated.
+  template <class... Ts>
+  static B* try_create(Ts&&... ts) {
+    void* storage = control_block_storage<B>::try_allocate();
+    if (!storage) {
+      return nullptr;
+    }
+    B* b = nullptr;
+    ISOCPP_P0201_POLYMORPHIC_VALUE_TRY {
+      b = ::new (storage) B(std::forward<Ts>(ts)...);
+    }
+    ISOCPP_P0201_POLYMORPHIC_VALUE_CATCH_ALL {
+      control_block_storage<B>::deallocate(storage);
+      ISOCPP_P0201_POLYMORPHIC_VALUE_RETHROW;
+    }
+    return b;
+  }
+
+  control_block* try_clone() const {
+    void* storage = control_block_storage<B>::try_allocate();
+    if (!storage) {
+      return nullptr;
+    }
+    control_block* cb = nullptr;
+    ISOCPP_P0201_POLYMORPHIC_VALUE_TRY {
+      cb = static_cast<const B&>(*this).clone_into(storage);
+    }
+    ISOCPP_P0201_POLYMORPHIC_VALUE_CATCH_ALL {
+      control_block_storage<B>::deallocate(storage);
+      ISOCPP_P0201_POLYMORPHIC_VALUE_RETHROW;
+    }
+    return cb;
+  }
+
+  control_block* move_into(void* storage) {
+    return ::new (storage) B(std::move(static_cast<B&>(*this)));
+  }
+
+  void destroy() noexcept {
+    auto* b = static_cast<B*>(this);
+    b->~B();
+    control_block_storage<B>::deallocate(b);
+  }
 };
 
-template <class T, class U = T>
-class direct_control_block : public control_block<T> {
+template <class U>
+class direct_control_block
+    : public control_block_impl<direct_control_block<U>> {
   static_assert(!std::is_reference<U>::value, "");
   U u_;
 
  public:
+  static constexpr bool holds_exact_type = true;
+
   template <class... Ts>
   explicit direct_control_block(Ts&&... ts) : u_(U(std::forward<Ts>(ts)...)) {}
 
-  std::unique_ptr<control_block<T>, control_block_deleter> clone()
-      const override {
-    return std::unique_ptr<direct_control_block, control_block_deleter>(
-        new direct_control_block(*this));
+  control_block* clone() const { return this->create(*this); }
+
+  control_block* clone_into(void* storage) const {
+    return ::new (storage) direct_control_block(*this);
   }
 
-  T* ptr() override { return std::addressof(u_); }
-};
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_PMR
+  control_block* clone_to(std::pmr::memory_resource* r) const {
+    return allocate_direct_control_block<U>(
+        std::pmr::polymorphic_allocator<U>(r), u_);
+  }
 
-template <class T, class U, class C, class D>
-class pointer_control_block : public control_block<T>, public C {
-  std::unique_ptr<U, D> p_;
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_ALLOCATION_RESOURCE
+  // The resource the storage of the block was allocated from.
+  std::pmr::memory_resource* resource() const noexcept {
+    auto* r = allocation_header_of(this).resource;
+    return r ? r : std::pmr::new_delete_resource();
+  }
+#endif
+#endif
+
+  U* ptr() noexcept { return std::addressof(u_); }
+};
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_LARGE_OBJECTS
+inline std::size_t page_size() noexcept {
+  static const auto size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+  return size;
+}
+
+// Maps a new memory file of `size` bytes privately into `fd`, or returns
+// null.
+inline void* map_memory_file(std::size_t size, int& fd) noexcept {
+  fd = ::memfd_create("polymorphic_value", MFD_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  if (::ftruncate(fd, static_cast<off_t>(size)) == 0) {
+    void* p =
+        ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      return p;
+    }
+  }
+  ::close(fd);
+  fd = -1;
+  return nullptr;
+}
+
+// Calls `f(offset, length)` for each run of pages of the private file
+// mapping `p` of `size` bytes that have been written since they were mapped,
+// as reported by `/proc/self/pagemap`, or once for all pages if that is not
+// available.
+template <class F>
+void for_each_written_run(const void* p, std::size_t size, F f) noexcept {
+  constexpr std::uint64_t present = std::uint64_t(1) << 63;
+  constexpr std::uint64_t swapped = std::uint64_t(1) << 62;
+  constexpr std::uint64_t file_page = std::uint64_t(1) << 61;
+  constexpr std::size_t batch = 512;
+
+  const auto page = page_size();
+  const auto pages = size / page;
+  const auto first = reinterpret_cast<std::uintptr_t>(p) / page;
+  const int pagemap = ::open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  std::uint64_t entries[batch];
+  std::size_t run = 0;
+  for (std::size_t i = 0; i < pages; i += batch) {
+    const auto n = std::min(batch, pages - i);
+    const auto bytes = n * sizeof(std::uint64_t);
+    const bool known =
+        pagemap >= 0 &&
+        ::pread(pagemap, entries, bytes,
+                static_cast<off_t>((first + i) * sizeof(std::uint64_t))) ==
+            static_cast<ssize_t>(bytes);
+    for (std::size_t j = 0; j < n; ++j) {
+      const auto e = entries[j];
+      if (known && !((e & (present | swapped)) && !(e & file_page))) {
+        if (run < i + j) {
+          f(run * page, (i + j - run) * page);
+        }
+        run = i + j + 1;
+      }
+    }
+  }
+  if (run < pages) {
+    f(run * page, (pages - run) * page);
+  }
+  if (pagemap >= 0) {
+    ::close(pagemap);
+  }
+}
+
+// Copies to `to` the pages of the private file mapping `from` that have been
+// written since they were mapped.
+inline void copy_written_pages(const void* from, void* to,
+                               std::size_t size) noexcept {
+  for_each_written_run(from, size, [&](std::size_t offset, std::size_t n) {
+    std::memcpy(static_cast<unsigned char*>(to) + offset,
+                static_cast<const unsigned char*>(from) + offset, n);
+  });
+}
+
+// Writes to `fd` the pages of the private mapping `p` of it that have been
+// written since they were mapped. Returns false if the file cannot be
+// written.
+inline bool write_written_pages(int fd, const void* p,
+                                std::size_t size) noexcept {
+  bool written = true;
+  for_each_written_run(p, size, [&](std::size_t offset, std::size_t n) {
+    for (std::size_t done = 0; written && done < n;) {
+      const auto w = ::pwrite(fd, static_cast<const unsigned char*>(p) +
+                                      offset + done,
+                              n - done, static_cast<off_t>(offset + done));
+      written = w > 0;
+      done += written ? static_cast<std::size_t>(w) : 0;
+    }
+  });
+  return written;
+}
+
+// Control block that holds a `U` in a private mapping of its own memory file.
+// The first copy writes the block to the file and maps it again from there,
+// so that the file keeps the contents at the time of the copy, which copies
+// map privately. Copies of a block that was written since then copy the
+// written pages. Blocks copied into other storage are not mapped and are
+// copied into a new file.
+//
+// Blocks are never mapped shared, so processes forked from one another do
+// not see each other's writes. A block that was not copied before a fork is
+// copied into a new file in the child, whose parent may still write the old
+// one.
+template <class U>
+class large_object_control_block
+    : public control_block_impl<large_object_control_block<U>> {
+  struct mapped_tag {};
+
+  U u_;
+  int fd_ = -1;
+  ::pid_t pid_ = -1;
+  mutable std::atomic<bool> private_{false};
+
+  static std::size_t mapping_size() noexcept {
+    const auto page = page_size();
+    return (sizeof(large_object_control_block) + page - 1) / page * page;
+  }
+
+  // Writes this block to its file and maps it again from there. The new
+  // mapping is made before the old one is replaced, so that failing to
+  // reserve memory for it leaves the block as it was.
+  bool map_privately() const noexcept {
+    const auto size = mapping_size();
+    if (!write_written_pages(fd_, this, size)) {
+      return false;
+    }
+    void* p =
+        ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_, 0);
+    if (p == MAP_FAILED) {
+      return false;
+    }
+    auto* self = const_cast<large_object_control_block*>(this);
+    if (::mremap(p, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, self) !=
+        MAP_FAILED) {
+      return true;
+    }
+    ::munmap(p, size);
+    // The file holds the contents of the block, which is mapped again in case
+    // the failed move unmapped it.
+    ::mmap(self, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd_,
+           0);
+    return false;
+  }
+
+ public:
+  static constexpr bool holds_exact_type = true;
+  static constexpr bool uses_control_block_storage = false;
+
+  template <class... Ts>
+  explicit large_object_control_block(mapped_tag, int fd, Ts&&... ts)
+      : u_(std::forward<Ts>(ts)...), fd_(fd), pid_(::getpid()) {}
+
+  explicit large_object_control_block(const U& u) : u_(u) {}
+
+  large_object_control_block(large_object_control_block&& b)
+      : u_(std::move(b.u_)) {}
+
+  ~large_object_control_block() = default;
+
+  template <class... Ts>
+  static large_object_control_block* create(Ts&&... ts) {
+    auto* b = try_create(std::forward<Ts>(ts)...);
+    if (!b) {
+      ISOCPP_P0201_POLYMORPHIC_VALUE_THROW(std::bad_alloc());
+    }
+    return b;
+  }
+
+  // As `create`, but returns null if the memory file cannot be mapped.
+  template <class... Ts>
+  static large_object_control_block* try_create(Ts&&... ts) {
+    const auto size = mapping_size();
+    int fd = -1;
+    void* storage = map_memory_file(size, fd);
+    if (!storage) {
+      return nullptr;
+    }
+    large_object_control_block* b = nullptr;
+    ISOCPP_P0201_POLYMORPHIC_VALUE_TRY {
+      b = ::new (storage)
+          large_object_control_block(mapped_tag{}, fd, std::forward<Ts>(ts)...);
+    }
+    ISOCPP_P0201_POLYMORPHIC_VALUE_CATCH_ALL {
+      ::munmap(storage, size);
+      ::close(fd);
+      ISOCPP_P0201_POLYMORPHIC_VALUE_RETHROW;
+    }
+    return b;
+  }
+
+  control_block* clone() const {
+    auto* b = try_clone();
+    if (!b) {
+      ISOCPP_P0201_POLYMORPHIC_VALUE_THROW(std::bad_alloc());
+    }
+    return b;
+  }
+
+  control_block* try_clone() const {
+    if (fd_ < 0) {
+      return try_create(u_);
+    }
+    // The flag is set before the block is written to its file, so that
+    // copies are marked as privately mapped. If the block was created in
+    // another process or cannot be remapped, it is copied into a new file
+    // instead, as it is when its file cannot be mapped again.
+    const bool written_privately = private_.exchange(true);
+    if (!written_privately && (pid_ != ::getpid() || !map_privately())) {
+      private_.store(false);
+      return try_create(u_);
+    }
+    const auto size = mapping_size();
+    const int fd = ::dup(fd_);
+    if (fd < 0) {
+      return try_create(u_);
+    }
+    void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      ::close(fd);
+      return try_create(u_);
+    }
+    if (written_privately) {
+      copy_written_pages(this, p, size);
+    }
+    auto* b = std::launder(static_cast<large_object_control_block*>(p));
+    b->fd_ = fd;
+    return b;
+  }
+
+  control_block* clone_into(void* storage) const {
+    return ::new (storage) large_object_control_block(u_);
+  }
+
+  U* ptr() noexcept { return std::addressof(u_); }
+
+  std::size_t allocated_size() const noexcept {
+    return fd_ >= 0 ? mapping_size() : sizeof(large_object_control_block);
+  }
+
+  void destroy() noexcept {
+    const int fd = fd_;
+    this->~large_object_control_block();
+    if (fd >= 0) {
+      ::munmap(this, mapping_size());
+      ::close(fd);
+    }
+  }
+};
+
+// The control block of objects of type `U` created in place.
+template <class U>
+using direct_block_t =
+    std::conditional_t<uses_large_object_storage<U>::value,
+                       large_object_control_block<U>, direct_control_block<U>>;
+#else
+template <class U>
+using direct_block_t = direct_control_block<U>;
+#endif
+
+// Control block that holds a copy of a `U` made by the `copy_into` member of
+// the copier `C` in its own storage.
+template <class U, class C>
+class copier_control_block
+    : public control_block_impl<copier_control_block<U, C>>,
+      public C {
+  alignas(U) unsigned char storage_[sizeof(U)];
+
+ public:
+  static constexpr bool holds_exact_type = true;
+
+  copier_control_block(const U& u, const C& c) : C(c) {
+    C::copy_into(u, storage_);
+  }
+
+  copier_control_block(const copier_control_block& b)
+      : copier_control_block(*b.ptr(), b) {}
+
+  ~copier_control_block() { ptr()->~U(); }
+
+  control_block* clone() const { return this->create(*this); }
+
+  control_block* clone_into(void* storage) const {
+    return ::new (storage) copier_control_block(*this);
+  }
+
+  U* ptr() noexcept { return std::launder(reinterpret_cast<U*>(storage_)); }
+
+  const U* ptr() const noexcept {
+    return std::launder(reinterpret_cast<const U*>(storage_));
+  }
+};
+
+template <class U, class C, class D>
+class pointer_control_block
+    : public control_block_impl<pointer_control_block<U, C, D>>,
+      public C {
+  std::unique_ptr<U, D> p_;
 
  public:
   explicit pointer_control_block(U* u, C c, D d)
       : C(std::move(c)), p_(u, std::move(d)) {}
 
-  explicit pointer_control_block(std::unique_ptr<U, D> p, C c)
-      : C(std::move(c)), p_(std::move(p)) {}
+  explicit pointer_control_block(std::unique_ptr<U, D> p, C c)
+      : C(std::move(c)), p_(std::move(p)) {}
+
+  control_block* clone() const {
+    assert(p_);
+    if constexpr (copies_directly<U, C, D>::value) {
+      return direct_block_t<U>::create(*p_);
+    } else if constexpr (copies_into<C, U>::value) {
+      return copier_control_block<U, C>::create(*p_,
+                                                static_cast<const C&>(*this));
+    } else {
+      std::unique_ptr<U, D> p(C::operator()(*p_), p_.get_deleter());
+      return this->create(std::move(p), static_cast<const C&>(*this));
+    }
+  }
+
+  control_block* try_clone() const {
+    assert(p_);
+    if constexpr (copies_directly<U, C, D>::value) {
+      return direct_block_t<U>::try_create(*p_);
+    } else if constexpr (copies_into<C, U>::value) {
+      return copier_control_block<U, C>::try_create(
+          *p_, static_cast<const C&>(*this));
+    } else {
+      return control_block_impl<pointer_control_block>::try_clone();
+    }
+  }
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_PMR
+  control_block* clone_to(std::pmr::memory_resource* r) const {
+    assert(p_);
+    if constexpr (copies_directly<U, C, D>::value) {
+      return allocate_direct_control_block<U>(
+          std::pmr::polymorphic_allocator<U>(r), *p_);
+    } else {
+      return clone();
+    }
+  }
+#endif
+
+  control_block* clone_into(void* storage) const {
+    assert(p_);
+    return ::new (storage) pointer_control_block(
+        C::operator()(*p_), static_cast<const C&>(*this), p_.get_deleter());
+  }
+
+  U* ptr() noexcept { return p_.get(); }
+};
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_CONSTEXPR
+
+// Control blocks used during constant evaluation, where the owned object
+// cannot be type-erased through `void*`. These are typed on the base type of
+// the owning `polymorphic_value` and are never created at runtime. Only
+// `destroy` is dispatched through their `control_block_ops`.
+template <class B>
+constexpr void destroy_constexpr_control_block(control_block& b) noexcept {
+  delete static_cast<B*>(&b);
+}
+
+template <class B>
+inline constexpr control_block_ops constexpr_control_block_ops = {
+    nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+    &destroy_constexpr_control_block<B>,
+    nullptr, 0, 0, 0, false, nullptr, nullptr, 0, false,
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_PMR
+    nullptr, nullptr,
+#endif
+};
+
+class constexpr_control_block_base : public control_block {
+  std::size_t type_tag_;
+
+ protected:
+  constexpr constexpr_control_block_base(const control_block_ops* ops,
+                                         std::size_t type_tag) noexcept
+      : control_block(ops), type_tag_(type_tag) {}
+
+ public:
+  constexpr std::size_t typed_tag() const noexcept { return type_tag_; }
+};
+
+template <class T>
+class constexpr_control_block : public constexpr_control_block_base {
+  using clone_fn = constexpr_control_block* (*)(const constexpr_control_block&);
+  using ptr_fn = T* (*)(constexpr_control_block&) noexcept;
+  using destroy_fn = void (*)(constexpr_control_block*) noexcept;
+
+  clone_fn clone_;
+  ptr_fn ptr_;
+  destroy_fn destroy_;
+
+ protected:
+  constexpr constexpr_control_block(const control_block_ops* ops,
+                                    std::size_t type_tag, clone_fn clone,
+                                    ptr_fn ptr, destroy_fn destroy) noexcept
+      : constexpr_control_block_base(ops, type_tag),
+        clone_(clone),
+        ptr_(ptr),
+        destroy_(destroy) {}
+
+ public:
+  constexpr constexpr_control_block* typed_clone() const {
+    return clone_(*this);
+  }
+
+  constexpr T* typed_ptr() noexcept { return ptr_(*this); }
+
+  constexpr void typed_destroy() noexcept { destroy_(this); }
+};
+
+template <class T, class U>
+class constexpr_direct_control_block : public constexpr_control_block<T> {
+  U u_;
+
+  static constexpr constexpr_control_block<T>* clone_op(
+      const constexpr_control_block<T>& b) {
+    return new constexpr_direct_control_block(
+        static_cast<const constexpr_direct_control_block&>(b));
+  }
+
+  static constexpr T* ptr_op(constexpr_control_block<T>& b) noexcept {
+    return std::addressof(static_cast<constexpr_direct_control_block&>(b).u_);
+  }
+
+  static constexpr void destroy_op(constexpr_control_block<T>* b) noexcept {
+    delete static_cast<constexpr_direct_control_block*>(b);
+  }
+
+ public:
+  template <class... Ts>
+  constexpr explicit constexpr_direct_control_block(Ts&&... ts)
+      : constexpr_control_block<T>(
+            &constexpr_control_block_ops<constexpr_direct_control_block>,
+            type_tag_v<std::remove_cv_t<U>>, &clone_op, &ptr_op, &destroy_op),
+        u_(U(std::forward<Ts>(ts)...)) {}
+};
+
+// Adapts the control block of a `polymorphic_value<U>` converted to a
+// `polymorphic_value<T>`.
+template <class T, class U>
+class constexpr_delegating_control_block : public constexpr_control_block<T> {
+  constexpr_control_block<U>* delegate_;
+
+  static constexpr constexpr_control_block<T>* clone_op(
+      const constexpr_control_block<T>& b) {
+    auto& self = static_cast<const constexpr_delegating_control_block&>(b);
+    return new constexpr_delegating_control_block(
+        self.delegate_->typed_clone());
+  }
+
+  static constexpr T* ptr_op(constexpr_control_block<T>& b) noexcept {
+    return static_cast<constexpr_delegating_control_block&>(b)
+        .delegate_->typed_ptr();
+  }
+
+  static constexpr void destroy_op(constexpr_control_block<T>* b) noexcept {
+    delete static_cast<constexpr_delegating_control_block*>(b);
+  }
+
+ public:
+  constexpr explicit constexpr_delegating_control_block(
+      constexpr_control_block<U>* delegate) noexcept
+      : constexpr_control_block<T>(
+            &constexpr_control_block_ops<constexpr_delegating_control_block>,
+            delegate->typed_tag(), &clone_op, &ptr_op, &destroy_op),
+        delegate_(delegate) {}
+
+  constexpr ~constexpr_delegating_control_block() {
+    delegate_->typed_destroy();
+  }
+};
+
+#endif
+
+// Owning pointer to a control block that keeps the type tag of the owned
+// object in the low bits of the pointer, which are always zero. Pointers
+// cannot be tagged during constant evaluation, where the tag is read from the
+// control block instead.
+class tagged_control_block_ptr {
+  static constexpr std::uintptr_t tag_mask = alignof(control_block) - 1;
+
+  control_block* p_ = nullptr;
+
+  static constexpr bool is_constant_evaluated() noexcept {
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_CONSTEXPR
+    return std::is_constant_evaluated();
+#else
+    return false;
+#endif
+  }
+
+ public:
+  constexpr tagged_control_block_ptr() = default;
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR explicit tagged_control_block_ptr(
+      control_block* p) noexcept {
+    reset(p);
+  }
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR tagged_control_block_ptr(
+      tagged_control_block_ptr&& p) noexcept
+      : p_(std::exchange(p.p_, nullptr)) {}
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR tagged_control_block_ptr& operator=(
+      tagged_control_block_ptr&& p) noexcept {
+    reset(p.release());
+    return *this;
+  }
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR ~tagged_control_block_ptr() {
+    reset();
+  }
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR control_block* get() const noexcept {
+    if (is_constant_evaluated()) {
+      return p_;
+    }
+    return reinterpret_cast<control_block*>(
+        reinterpret_cast<std::uintptr_t>(p_) & ~tag_mask);
+  }
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR std::size_t tag() const noexcept {
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_CONSTEXPR
+    if (std::is_constant_evaluated()) {
+      return p_ ? static_cast<constexpr_control_block_base*>(p_)->typed_tag()
+                : 0;
+    }
+#endif
+    return reinterpret_cast<std::uintptr_t>(p_) & tag_mask;
+  }
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR control_block* release() noexcept {
+    auto* p = get();
+    p_ = nullptr;
+    return p;
+  }
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR void reset(
+      control_block* p = nullptr) noexcept {
+    auto* old = get();
+    if (is_constant_evaluated() || !p) {
+      p_ = p;
+    } else {
+      p_ = reinterpret_cast<control_block*>(
+          reinterpret_cast<std::uintptr_t>(p) | p->type_tag());
+    }
+    control_block_deleter{}(old);
+  }
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR void swap(
+      tagged_control_block_ptr& p) noexcept {
+    std::swap(p_, p.p_);
+  }
+
+  constexpr explicit operator bool() const noexcept { return p_ != nullptr; }
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR control_block* operator->()
+      const noexcept {
+    return get();
+  }
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR control_block& operator*()
+      const noexcept {
+    return *get();
+  }
+};
+
+// Copier for objects of intrusively clonable types.
+template <class U>
+struct intrusive_copy {
+  U* operator()(const U& u) const { return static_cast<U*>(u.clone()); }
+};
+
+template <class A>
+struct is_std_allocator : std::false_type {};
+
+template <class T>
+struct is_std_allocator<std::allocator<T>> : std::true_type {};
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_PMR
+template <class A>
+struct is_polymorphic_allocator : std::false_type {};
+
+template <class T>
+struct is_polymorphic_allocator<std::pmr::polymorphic_allocator<T>>
+    : std::true_type {};
+#endif
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_PMR
+// The memory resource used by `a`, or null if it is not known.
+template <class A>
+std::pmr::memory_resource* allocator_resource(const A& a) noexcept {
+  if constexpr (is_polymorphic_allocator<A>::value) {
+    return a.resource();
+  } else if constexpr (is_std_allocator<A>::value) {
+    return std::pmr::new_delete_resource();
+  } else {
+    return nullptr;
+  }
+}
+#endif
+
+template <typename A>
+struct allocator_wrapper : A {
+  allocator_wrapper(const A& a) : A(a) {}
+
+  const A& get_allocator() const { return static_cast<const A&>(*this); }
+};
+
+template <typename T, typename A, typename... Args>
+T* allocate_object(const A& a, Args&&... args) {
+  using t_allocator =
+      typename std::allocator_traits<A>::template rebind_alloc<T>;
+  using t_traits = std::allocator_traits<t_allocator>;
+  t_allocator t_alloc(a);
+  T* mem = t_traits::allocate(t_alloc, 1);
+  ISOCPP_P0201_POLYMORPHIC_VALUE_TRY {
+    t_traits::construct(t_alloc, mem, std::forward<Args>(args)...);
+  }
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CATCH_ALL {
+    t_traits::deallocate(t_alloc, mem, 1);
+    ISOCPP_P0201_POLYMORPHIC_VALUE_RETHROW;
+  }
+  return mem;
+}
+
+template <typename T, typename A>
+void deallocate_object(const A& a, T* p) {
+  using t_allocator =
+      typename std::allocator_traits<A>::template rebind_alloc<T>;
+  using t_traits = std::allocator_traits<t_allocator>;
+  t_allocator t_alloc(a);
+  t_traits::destroy(t_alloc, p);
+  t_traits::deallocate(t_alloc, p, 1);
+}
+
+template <class U, class A>
+class allocated_pointer_control_block
+    : public control_block_impl<allocated_pointer_control_block<U, A>>,
+      allocator_wrapper<A> {
+  U* p_;
+
+ public:
+  static constexpr bool uses_control_block_storage = false;
+
+  explicit allocated_pointer_control_block(U* u, A a)
+      : allocator_wrapper<A>(a), p_(u) {}
+
+  allocated_pointer_control_block(
+      allocated_pointer_control_block&& other) noexcept
+      : allocator_wrapper<A>(other), p_(std::exchange(other.p_, nullptr)) {}
+
+  ~allocated_pointer_control_block() {
+    if (p_) {
+      detail::deallocate_object(this->get_allocator(), p_);
+    }
+  }
+
+  control_block* clone() const {
+    assert(p_);
+    return allocate_direct_control_block<U>(this->get_allocator(), *p_);
+  }
+
+  // As `clone`, but returns null if the allocator cannot allocate the copy.
+  control_block* try_clone() const
+      noexcept(std::is_nothrow_copy_constructible<U>::value) {
+    ISOCPP_P0201_POLYMORPHIC_VALUE_TRY { return clone(); }
+    ISOCPP_P0201_POLYMORPHIC_VALUE_CATCH_BAD_ALLOC { return nullptr; }
+  }
+
+  control_block* clone_into(void* storage) const {
+    assert(p_);
+    auto* cloned_ptr = detail::allocate_object<U>(this->get_allocator(), *p_);
+    return ::new (storage)
+        allocated_pointer_control_block(cloned_ptr, this->get_allocator());
+  }
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_PMR
+  control_block* clone_to(std::pmr::memory_resource* r) const {
+    assert(p_);
+    return allocate_direct_control_block<U>(
+        std::pmr::polymorphic_allocator<U>(r), *p_);
+  }
+
+  std::pmr::memory_resource* resource() const noexcept {
+    return allocator_resource(this->get_allocator());
+  }
+#endif
+
+  U* ptr() noexcept { return p_; }
+
+  void destroy() noexcept {
+    detail::deallocate_object(this->get_allocator(), this);
+  }
+};
+
+// Control block that holds a `U` in its own storage, allocated, constructed
+// and destroyed with `A`.
+template <class U, class A>
+class allocated_direct_control_block
+    : public control_block_impl<allocated_direct_control_block<U, A>>,
+      allocator_wrapper<A> {
+  using u_allocator =
+      typename std::allocator_traits<A>::template rebind_alloc<U>;
+  using u_traits = std::allocator_traits<u_allocator>;
+
+  alignas(U) unsigned char storage_[sizeof(U)];
+
+ public:
+  static constexpr bool holds_exact_type = true;
+  static constexpr bool uses_control_block_storage = false;
+
+  template <class... Ts>
+  explicit allocated_direct_control_block(const A& a, Ts&&... ts)
+      : allocator_wrapper<A>(a) {
+    u_allocator u_alloc(a);
+    u_traits::construct(u_alloc, ptr(), std::forward<Ts>(ts)...);
+  }
+
+  allocated_direct_control_block(allocated_direct_control_block&& other)
+      : allocated_direct_control_block(other.get_allocator(),
+                                       std::move(*other.ptr())) {}
+
+  ~allocated_direct_control_block() {
+    u_allocator u_alloc(this->get_allocator());
+    u_traits::destroy(u_alloc, ptr());
+  }
+
+  control_block* clone() const {
+    return allocate_direct_control_block<U>(this->get_allocator(), *ptr());
+  }
+
+  // As `clone`, but returns null if the allocator cannot allocate the copy.
+  control_block* try_clone() const
+      noexcept(std::is_nothrow_copy_constructible<U>::value) {
+    ISOCPP_P0201_POLYMORPHIC_VALUE_TRY { return clone(); }
+    ISOCPP_P0201_POLYMORPHIC_VALUE_CATCH_BAD_ALLOC { return nullptr; }
+  }
+
+  control_block* clone_into(void* storage) const {
+    return ::new (storage)
+        allocated_direct_control_block(this->get_allocator(), *ptr());
+  }
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_PMR
+  control_block* clone_to(std::pmr::memory_resource* r) const {
+    return allocate_direct_control_block<U>(
+        std::pmr::polymorphic_allocator<U>(r), *ptr());
+  }
+
+  std::pmr::memory_resource* resource() const noexcept {
+    return allocator_resource(this->get_allocator());
+  }
+#endif
+
+  U* ptr() noexcept { return std::launder(reinterpret_cast<U*>(storage_)); }
+
+  const U* ptr() const noexcept {
+    return std::launder(reinterpret_cast<const U*>(storage_));
+  }
+
+  void destroy() noexcept {
+    detail::deallocate_object(this->get_allocator(), this);
+  }
+};
+
+// Allocates a control block holding a `U` constructed from `ts` with `a`.
+template <class U, class A, class... Ts>
+allocated_direct_control_block<U, A>* allocate_direct_control_block(
+    const A& a, Ts&&... ts) {
+  using b_allocator = typename std::allocator_traits<A>::template rebind_alloc<
+      allocated_direct_control_block<U, A>>;
+  using b_traits = std::allocator_traits<b_allocator>;
+  b_allocator b_alloc(a);
+  auto* b = b_traits::allocate(b_alloc, 1);
+  ISOCPP_P0201_POLYMORPHIC_VALUE_TRY {
+    ::new (static_cast<void*>(b))
+        allocated_direct_control_block<U, A>(a, std::forward<Ts>(ts)...);
+  }
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CATCH_ALL {
+    b_traits::deallocate(b_alloc, b, 1);
+    ISOCPP_P0201_POLYMORPHIC_VALUE_RETHROW;
+  }
+  return b;
+}
+
+template <std::size_t Size, std::size_t Align>
+class inline_storage {
+  // Storage must be able to hold a control block header followed by an
+  // object of up to `Size` bytes aligned to `Align`.
+  static constexpr std::size_t align =
+      Align < alignof(void*) ? alignof(void*) : Align;
+  static constexpr std::size_t size =
+      ((sizeof(void*) + align - 1) / align + (Size + align - 1) / align) *
+      align;
+
+  alignas(align) unsigned char data_[size];
+
+ public:
+  template <class B>
+  static constexpr bool can_hold = sizeof(B) <= size && alignof(B) <= align &&
+                                   std::is_nothrow_move_constructible<B>::value;
+
+  void* data() noexcept { return data_; }
+
+  bool holds(const void* p) const noexcept {
+    std::less<const void*> less;
+    return !less(p, data_) && less(p, data_ + size);
+  }
+};
+
+}  // end namespace detail
+
+// Exclusive upper bound on `type_tag` values.
+inline constexpr std::size_t max_type_tag = alignof(detail::control_block);
+
+template <class T>
+struct default_copy {
+  using deleter_type = std::default_delete<T>;
+  T* operator()(const T& t) const { return new T(t); }
+};
+
+template <class T>
+struct copier_traits : detail::copier_traits_deleter_base<T, void> {};
+
+// Specialize as `std::true_type` for class hierarchies whose root `T`
+// provides `virtual T* clone() const` returning a copy of the dynamic type
+// allocated with `new`. `polymorphic_value<T>` then owns objects directly
+// and copies them with `clone`, without a control block.
+template <class T>
+struct is_intrusively_clonable : std::false_type {};
+
+class bad_polymorphic_value_construction : public std::exception {
+ public:
+  bad_polymorphic_value_construction() noexcept = default;
+
+  const char* what() const noexcept override {
+    return "Dynamic and static type mismatch in polymorphic_value "
+           "construction";
+  }
+};
+
+class allocation_budget_exhausted : public std::bad_alloc {
+ public:
+  allocation_budget_exhausted() noexcept = default;
+
+  const char* what() const noexcept override {
+    return "Allocation budget exhausted";
+  }
+};
+
+template <class T>
+class polymorphic_value;
+
+// Deleter for objects cloned into caller-provided storage by
+// `polymorphic_value::clone_into`. Destroys the object without releasing the
+// storage.
+template <class T>
+class placement_deleter {
+  template <class U>
+  friend class polymorphic_value;
+
+  detail::control_block* cb_ = nullptr;
+
+  explicit placement_deleter(detail::control_block* cb) noexcept
+      : cb_(cb) {}
+
+ public:
+  placement_deleter() = default;
+
+  void operator()(T*) const noexcept {
+    assert(cb_);
+    cb_->destroy_in_place();
+  }
+};
+
+template <class T>
+struct is_polymorphic_value : std::false_type {};
+
+template <class T>
+struct is_polymorphic_value<polymorphic_value<T>> : std::true_type {};
+
+////////////////////////////////////////////////////////////////////////////////
+// `polymorphic_value` class definition
+////////////////////////////////////////////////////////////////////////////////
+
+template <class T>
+class polymorphic_value {
+  static_assert(!std::is_union<T>::value, "");
+  static_assert(std::is_class<T>::value, "");
+
+  template <class U>
+  friend class polymorphic_value;
+
+  template <class T_, class U, class... Ts>
+  friend ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR polymorphic_value<T_>
+  make_polymorphic_value(Ts&&... ts);
+
+  template <class T_, class U, class... Ts>
+  friend polymorphic_value<T_> try_make_polymorphic_value(Ts&&... ts);
+
+  template <class T_, class U, class A, class... Ts>
+  friend polymorphic_value<T_> allocate_polymorphic_value(std::allocator_arg_t,
+                                                          A& a, Ts&&... ts);
+
+  // Intrusively clonable objects are owned directly through `ptr_` when
+  // there is no control block.
+  static constexpr bool intrusive =
+      is_intrusively_clonable<std::remove_cv_t<T>>::value;
+
+  T* ptr_ = nullptr;
+  detail::tagged_control_block_ptr cb_;
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR void reset() noexcept {
+    if constexpr (intrusive) {
+      static_assert(std::has_virtual_destructor<T>::value,
+                    "intrusively clonable types are deleted through a pointer "
+                    "to their root and need a virtual destructor");
+      if (!cb_) {
+        delete ptr_;
+      }
+    }
+    cb_.reset();
+    ptr_ = nullptr;
+  }
+
+  // Constructs a `U` owned by `*this`, which must be empty.
+  template <class U, class... Ts>
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR void construct(Ts&&... ts) {
+    if constexpr (intrusive) {
+      ptr_ = new U(std::forward<Ts>(ts)...);
+    } else {
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_CONSTEXPR
+      if (std::is_constant_evaluated()) {
+        auto* cb = new detail::constexpr_direct_control_block<T, U>(
+            std::forward<Ts>(ts)...);
+        cb_.reset(cb);
+        ptr_ = cb->typed_ptr();
+      } else
+#endif
+      {
+        auto* cb = detail::direct_block_t<U>::create(std::forward<Ts>(ts)...);
+        cb_.reset(cb);
+        ptr_ = cb->ptr();
+      }
+    }
+  }
+
+  // As `construct`, but leaves `*this` empty if memory cannot be allocated.
+  template <class U, class... Ts>
+  void try_construct(Ts&&... ts) {
+    if constexpr (intrusive) {
+      ptr_ = new (std::nothrow) U(std::forward<Ts>(ts)...);
+    } else {
+      auto* cb =
+          detail::direct_block_t<U>::try_create(std::forward<Ts>(ts)...);
+      if (cb) {
+        cb_.reset(cb);
+        ptr_ = cb->ptr();
+      }
+    }
+  }
+
+ public:
+  //
+  // Destructor
+  //
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR ~polymorphic_value() { reset(); }
+
+  //
+  // Constructors
+  //
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR polymorphic_value() {}
+
+  template <class U, class C, class D,
+            class = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+  explicit polymorphic_value(U* u, C copier, D deleter) {
+    if (!u) {
+      return;
+    }
+
+#ifndef ISOCPP_P0201_POLYMORPHIC_VALUE_NO_RTTI
+    if (std::is_same<D, std::default_delete<U>>::value &&
+        std::is_same<C, default_copy<U>>::value && typeid(*u) != typeid(U))
+      ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTRUCTION_ERROR;
+#endif
+    if constexpr (intrusive && std::is_same<D, std::default_delete<U>>::value &&
+                  std::is_same<C, default_copy<U>>::value) {
+      ptr_ = u;
+      return;
+    }
+    std::unique_ptr<U, D> p(u, std::move(deleter));
+
+    cb_.reset(detail::pointer_control_block<U, C, D>::create(
+        std::move(p), std::move(copier)));
+    ptr_ = u;
+  }
+
+  template <class U, class C, class D = typename copier_traits<C>::deleter_type,
+            class V = std::enable_if_t<std::is_convertible_v<U*, T*> &&
+                                       std::is_default_constructible_v<D> &&
+                                       !std::is_pointer_v<D>>>
+  explicit polymorphic_value(U* u, C copier)
+      : polymorphic_value(u, std::move(copier), D{}) {}
+
+  template <
+      class U, class C = default_copy<U>,
+      class D = typename copier_traits<C>::deleter_type,
+      class = std::enable_if_t<
+          std::is_convertible_v<U*, T*> && std::is_default_constructible_v<C> &&
+          std::is_default_constructible_v<D> && !std::is_pointer_v<D>>>
+  explicit polymorphic_value(U* u) : polymorphic_value(u, C{}, D{}) {}
+
+  template <class U, class A,
+            class = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+  explicit polymorphic_value(U* u, std::allocator_arg_t, const A& alloc) {
+    if (!u) {
+      return;
+    }
+
+#ifndef ISOCPP_P0201_POLYMORPHIC_VALUE_NO_RTTI
+    if (typeid(*u) != typeid(U)) {
+      ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTRUCTION_ERROR;
+    }
+#endif
+
+    cb_.reset(
+        detail::allocate_object<detail::allocated_pointer_control_block<U, A>>(
+            alloc, u, alloc));
+    ptr_ = u;
+  }
+
+  //
+  // Copy-constructors
+  //
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR
+  polymorphic_value(const polymorphic_value& p) {
+    if (!p) {
+      return;
+    }
+    if constexpr (intrusive) {
+      if (!p.cb_) {
+        ptr_ = p.ptr_->clone();
+        return;
+      }
+    }
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_CONSTEXPR
+    if (std::is_constant_evaluated()) {
+      auto* cb = static_cast<detail::constexpr_control_block<T>*>(p.cb_.get())
+                     ->typed_clone();
+      cb_.reset(cb);
+      ptr_ = cb->typed_ptr();
+    } else
+#endif
+    {
+      auto offset = detail::subobject_offset(p.ptr_, *p.cb_);
+      cb_.reset(p.cb_->clone());
+      ptr_ = detail::subobject_at<T>(*cb_, offset);
+    }
+  }
+
+  //
+  // Move-constructors
+  //
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR
+  polymorphic_value(polymorphic_value&& p) noexcept {
+    ptr_ = p.ptr_;
+    cb_ = std::move(p.cb_);
+    p.ptr_ = nullptr;
+  }
+
+  //
+  // Converting constructors
+  //
+
+  template <class U,
+            class V = std::enable_if_t<!std::is_same<T, U>::value &&
+                                       std::is_convertible<U*, T*>::value>>
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR
+  explicit polymorphic_value(const polymorphic_value<U>& p)
+      : polymorphic_value(polymorphic_value<U>(p)) {}
+
+  // Takes over the control block of `p`, adjusting only the object pointer.
+  // Allocates only to give a control block to an intrusively clonable object
+  // that `T` cannot own directly.
+  template <class U,
+            class V = std::enable_if_t<!std::is_same<T, U>::value &&
+                                       std::is_convertible<U*, T*>::value>>
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR explicit polymorphic_value(
+      polymorphic_value<U>&& p) noexcept(!polymorphic_value<U>::intrusive ||
+                                         intrusive) {
+    if constexpr (polymorphic_value<U>::intrusive && !intrusive) {
+      if (!p.cb_ && p.ptr_) {
+        // Give the object a control block as `T` cannot own it directly.
+        using B = detail::pointer_control_block<U, detail::intrusive_copy<U>,
+                                                std::default_delete<U>>;
+        cb_.reset(B::create(p.ptr_, detail::intrusive_copy<U>{},
+                            std::default_delete<U>{}));
+        ptr_ = std::exchange(p.ptr_, nullptr);
+        return;
+      }
+    }
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_CONSTEXPR
+    if (std::is_constant_evaluated() && p.cb_) {
+      cb_.reset(new detail::constexpr_delegating_control_block<T, U>(
+          static_cast<detail::constexpr_control_block<U>*>(p.cb_.release())));
+    } else
+#endif
+    {
+      cb_ = std::move(p.cb_);
+    }
+    ptr_ = p.ptr_;
+    p.ptr_ = nullptr;
+  }
+
+  //
+  // In-place constructor
+  //
+
+  template <class U,
+            class V = std::enable_if_t<
+                std::is_convertible<std::decay_t<U>*, T*>::value &&
+                !is_polymorphic_value<std::decay_t<U>>::value>,
+            class... Ts>
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR
+  explicit polymorphic_value(std::in_place_type_t<U>, Ts&&... ts) {
+    construct<U>(std::forward<Ts>(ts)...);
+  }
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_PMR
+  //
+  // Allocator-extended constructors
+  //
+
+  // Values are created and copied with the memory resource of the allocator
+  // they are given. Objects are constructed with uses-allocator construction,
+  // so allocator-aware members of the owned object use the same resource.
+  // Objects copied by a user-provided copier or `clone` function are
+  // allocated by them.
+  using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+  polymorphic_value(std::allocator_arg_t, const allocator_type&) noexcept {}
+
+  polymorphic_value(std::allocator_arg_t, const allocator_type& a,
+                    const polymorphic_value& p) {
+    if (!p) {
+      return;
+    }
+    if constexpr (intrusive) {
+      if (!p.cb_) {
+        ptr_ = p.ptr_->clone();
+        return;
+      }
+    }
+    auto offset = detail::subobject_offset(p.ptr_, *p.cb_);
+    cb_.reset(p.cb_->clone_to(a.resource()));
+    ptr_ = detail::subobject_at<T>(*cb_, offset);
+  }
+
+  // Takes ownership of the object of `p` if it is held by a memory resource
+  // equal to that of `a`, or is an intrusively clonable object whose copy
+  // could not use it, and copies it otherwise.
+  polymorphic_value(std::allocator_arg_t, const allocator_type& a,
+                    polymorphic_value&& p) {
+    if constexpr (intrusive) {
+      if (!p.cb_) {
+        swap(p);
+        return;
+      }
+    }
+    auto* r = p.cb_ ? p.cb_->resource() : std::pmr::new_delete_resource();
+    if (r && r->is_equal(*a.resource())) {
+      swap(p);
+    } else {
+      polymorphic_value(std::allocator_arg, a, std::as_const(p)).swap(*this);
+    }
+  }
+
+  template <class U,
+            class V = std::enable_if_t<
+                std::is_convertible<std::decay_t<U>*, T*>::value &&
+                !is_polymorphic_value<std::decay_t<U>>::value>,
+            class... Ts>
+  polymorphic_value(std::allocator_arg_t, const allocator_type& a,
+                    std::in_place_type_t<U>, Ts&&... ts) {
+    auto* cb = detail::allocate_direct_control_block<U>(
+        std::pmr::polymorphic_allocator<U>(a), std::forward<Ts>(ts)...);
+    cb_.reset(cb);
+    ptr_ = cb->ptr();
+  }
+
+  // An allocator for the memory resource that holds the owned object, or for
+  // the default memory resource if `*this` is empty or its object was
+  // allocated otherwise.
+  allocator_type get_allocator() const noexcept {
+    auto* r = cb_ ? cb_->resource() : nullptr;
+    return allocator_type(r ? r : std::pmr::get_default_resource());
+  }
+#endif
+
+  //
+  // Assignment
+  //
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR
+  polymorphic_value& operator=(const polymorphic_value& p) {
+    if (std::addressof(p) == this) {
+      return *this;
+    }
+
+    if (!p) {
+      reset();
+      return *this;
+    }
+
+    // Objects of the same type are copy-assigned in place where that cannot
+    // throw.
+    if (cb_ && p.cb_ && cb_->assign(*p.cb_)) {
+      return *this;
+    }
+
+    polymorphic_value tmp(p);
+    swap(tmp);
+    return *this;
+  }
+
+  //
+  // Move-assignment
+  //
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR
+  polymorphic_value& operator=(polymorphic_value&& p) noexcept {
+    if (std::addressof(p) == this) {
+      return *this;
+    }
+
+    reset();
+    cb_ = std::move(p.cb_);
+    ptr_ = p.ptr_;
+    p.ptr_ = nullptr;
+    return *this;
+  }
+
+  template <class U,
+            class V = std::enable_if_t<!std::is_same<T, U>::value &&
+                                       std::is_convertible<U*, T*>::value>>
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR polymorphic_value& operator=(
+      polymorphic_value<U>&& p) noexcept(!polymorphic_value<U>::intrusive ||
+                                         intrusive) {
+    polymorphic_value tmp(std::move(p));
+    swap(tmp);
+    return *this;
+  }
+
+  //
+  // Modifiers
+  //
+
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR
+  void swap(polymorphic_value& p) noexcept {
+    using std::swap;
+    swap(ptr_, p.ptr_);
+    cb_.swap(p.cb_);
+  }
+
+  // Replaces the owned object with a `U` constructed from `ts`. The storage of
+  // the current control block is reused if it can hold the control block of
+  // a `U`. If construction throws, `*this` is left empty. As with
+  // `std::optional::emplace`, `ts` must not refer to the owned object.
+  template <class U, class V = std::enable_if_t<
+                         std::is_convertible<std::decay_t<U>*, T*>::value &&
+                         !is_polymorphic_value<std::decay_t<U>>::value>,
+            class... Ts>
+  U& emplace(Ts&&... ts) {
+    if constexpr (intrusive) {
+      reset();
+      auto* u = new U(std::forward<Ts>(ts)...);
+      ptr_ = u;
+      return *u;
+    } else {
+      using B = detail::direct_block_t<U>;
+      B* b = nullptr;
+      if constexpr (B::uses_control_block_storage) {
+        if (cb_ && detail::control_block_storage<B>::can_reuse(*cb_)) {
+          auto* storage = cb_.release();
+          ptr_ = nullptr;
+          storage->destroy_in_place();
+          ISOCPP_P0201_POLYMORPHIC_VALUE_TRY {
+            b = ::new (static_cast<void*>(storage)) B(std::forward<Ts>(ts)...);
+          }
+          ISOCPP_P0201_POLYMORPHIC_VALUE_CATCH_ALL {
+            detail::control_block_storage<B>::deallocate(storage);
+            ISOCPP_P0201_POLYMORPHIC_VALUE_RETHROW;
+          }
+        }
+      }
+      if (!b) {
+        reset();
+        b = B::create(std::forward<Ts>(ts)...);
+      }
+      cb_.reset(b);
+      ptr_ = b->ptr();
+      return *b->ptr();
+    }
+  }
+
+  //
+  // Non-throwing clone
+  //
+
+  // Copies the owned object, or returns an empty value if memory for the
+  // copy cannot be allocated. Values adopted with `default_copy` are copied
+  // into a single block. Allocators and `clone` functions that throw
+  // `std::bad_alloc` also give an empty value. Objects copied by any other
+  // user-provided copier are allocated by it.
+  polymorphic_value try_clone() const {
+    polymorphic_value p;
+    if (!*this) {
+      return p;
+    }
+    if constexpr (intrusive) {
+      if (!cb_) {
+        ISOCPP_P0201_POLYMORPHIC_VALUE_TRY { p.ptr_ = ptr_->clone(); }
+        ISOCPP_P0201_POLYMORPHIC_VALUE_CATCH_BAD_ALLOC {}
+        return p;
+      }
+    }
+    auto offset = detail::subobject_offset(ptr_, *cb_);
+    if (auto* cb = cb_->try_clone()) {
+      p.cb_.reset(cb);
+      p.ptr_ = detail::subobject_at<T>(*cb, offset);
+    }
+    return p;
+  }
+
+  //
+  // Placement clone
+  //
+
+  // Size and alignment of the storage required by `clone_into`, or zero if
+  // `*this` is empty or directly owns an intrusively clonable object, which
+  // `clone_into` cannot copy.
+  std::size_t clone_size() const noexcept { return cb_ ? cb_->size() : 0; }
+
+  std::size_t clone_alignment() const noexcept {
+    return cb_ ? cb_->alignment() : 0;
+  }
+
+  // Copies the owned object into `storage`, which must be at least
+  // `clone_size()` bytes and aligned to `clone_alignment()`. The returned
+  // pointer destroys the copy but does not release `storage`.
+  std::unique_ptr<T, placement_deleter<T>> clone_into(void* storage) const {
+    if (!cb_) {
+      return nullptr;
+    }
+    assert(storage);
+    assert(reinterpret_cast<std::uintptr_t>(storage) % clone_alignment() ==
+           0);
+    auto offset = detail::subobject_offset(ptr_, *cb_);
+    auto* cb = cb_->clone_into(storage);
+    return std::unique_ptr<T, placement_deleter<T>>(
+        detail::subobject_at<T>(*cb, offset), placement_deleter<T>(cb));
+  }
+
+  //
+  // Observers
+  //
+
+  constexpr explicit operator bool() const {
+    if constexpr (intrusive) {
+      return cb_ || ptr_;
+    } else {
+      return bool(cb_);
+    }
+  }
+
+  // The `type_tag` of the owned object, or zero if `*this` is empty.
+  ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR
+  std::size_t type_tag() const noexcept { return cb_.tag(); }
+
+  // The memory owned by `*this`: the size and alignment of the dynamic type
+  // of the owned object, the overhead of its control block and the bytes
+  // allocated for both. If `recursive` is true, `nested` adds the bytes the
+  // object reports from a `std::size_t dynamic_memory_footprint() const`
+  // member. Objects owned without a control block report their static type.
+  value_footprint memory_footprint(bool recursive = false) const {
+    if (cb_) {
+      return cb_->footprint(recursive);
+    }
+    value_footprint f;
+    if (ptr_) {
+      f.object_size = sizeof(T);
+      f.object_alignment = alignof(T);
+      f.allocated = sizeof(T);
+      if (recursive) {
+        f.nested = detail::dynamic_memory_footprint(*ptr_);
+      }
+    }
+    return f;
+  }
+
+  constexpr const T* operator->() const {
+    assert(ptr_);
+    return ptr_;
+  }
+
+  constexpr const T& operator*() const {
+    assert(*this);
+    return *ptr_;
+  }
+
+  constexpr T* operator->() {
+    assert(*this);
+    return ptr_;
+  }
+
+  constexpr T& operator*() {
+    assert(*this);
+    return *ptr_;
+  }
+};
+
+//
+// polymorphic_value creation
+//
+template <class T, class U = T, class... Ts>
+ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR polymorphic_value<T>
+make_polymorphic_value(Ts&&... ts) {
+  polymorphic_value<T> p;
+  p.template construct<U>(std::forward<Ts>(ts)...);
+  return p;
+}
+
+// As `make_polymorphic_value`, but returns an empty value if memory cannot be
+// allocated.
+template <class T, class U = T, class... Ts>
+polymorphic_value<T> try_make_polymorphic_value(Ts&&... ts) {
+  polymorphic_value<T> p;
+  p.template try_construct<U>(std::forward<Ts>(ts)...);
+  return p;
+}
+
+template <class T, class U = T, class A = std::allocator<U>, class... Ts>
+polymorphic_value<T> allocate_polymorphic_value(std::allocator_arg_t, A& a,
+                                                Ts&&... ts) {
+  polymorphic_value<T> p;
+  auto* cb =
+      detail::allocate_direct_control_block<U>(a, std::forward<Ts>(ts)...);
+  p.cb_.reset(cb);
+  p.ptr_ = cb->ptr();
+  return p;
+}
+
+//
+// non-member swap
+//
+template <class T>
+ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTEXPR void swap(
+    polymorphic_value<T>& t, polymorphic_value<T>& u) noexcept {
+  t.swap(u);
+}
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_ALLOCATION_RESOURCE
+////////////////////////////////////////////////////////////////////////////////
+// Default allocation resource
+////////////////////////////////////////////////////////////////////////////////
+
+// Routes the storage that `polymorphic_value` allocates without an allocator
+// to `r`, and returns the previous resource. This covers control blocks,
+// objects created in place or by `make_polymorphic_value` and their copies,
+// copies of objects adopted with `default_copy` and the default deleter, and
+// the nodes of `compact_polymorphic_value`. Objects of intrusively clonable
+// types, objects adopted from a pointer, and copies made by other copiers are
+// allocated by `new` or by the copier, as they are released by `delete` or
+// the deleter. A null resource, the default, uses global operator new.
+// Storage is released to the resource it was allocated from, so the resource
+// may be changed while values are live; each resource must outlive the
+// storage allocated from it, including blocks kept by `control_block_pool`.
+// Available when `ISOCPP_P0201_POLYMORPHIC_VALUE_ALLOCATION_RESOURCE` is
+// defined.
+inline std::pmr::memory_resource* set_allocation_resource(
+    std::pmr::memory_resource* r) noexcept {
+  return detail::allocation_resource.exchange(r, std::memory_order_acq_rel);
+}
+
+inline std::pmr::memory_resource* get_allocation_resource() noexcept {
+  return detail::allocation_resource.load(std::memory_order_acquire);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// `control_block_pool` class definition
+////////////////////////////////////////////////////////////////////////////////
+
+// Control blocks of objects whose type specializes `uses_control_block_pool`
+// are kept on free lists, one for each 16-byte size class up to 512 bytes,
+// when destroyed and are reused by later allocations of the same size class.
+// Each thread caches the blocks it frees, and returns them to lists shared
+// by all threads without locking when its cache overflows or it exits.
+class control_block_pool {
+ public:
+  // Adds `n` free blocks, shared by all threads, for objects of type `U`
+  // created in place or by `make_polymorphic_value`.
+  template <class U>
+  static void reserve(std::size_t n) {
+    using storage =
+        detail::control_block_storage<detail::direct_control_block<U>>;
+    static_assert(storage::pooled,
+                  "U must use a control block pool and fit a size class");
+    detail::size_class_pools[storage::size_class].reserve(storage::pooled_size,
+                                                          n);
+  }
+
+  // Releases the free blocks shared by all threads and those cached by the
+  // calling thread.
+  static void trim() noexcept {
+    if (auto* cache = detail::local_thread_cache()) {
+      cache->trim();
+    }
+    for (auto& pool : detail::size_class_pools) {
+      pool.trim();
+    }
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// `allocation_budget` class definition
+////////////////////////////////////////////////////////////////////////////////
+
+// Usage of the storage reserved in an `allocation_budget` for one type.
+struct allocation_budget_counters {
+  std::size_t reserved = 0;
+  std::size_t in_use = 0;
+  std::size_t high_water = 0;
+  std::size_t failures = 0;
+};
+
+namespace detail {
+
+template <class T>
+inline constexpr char type_key = 0;
+
+// Fixed-size slots for objects of one type, reserved up front and kept on a
+// free list.
+class budget_pool {
+  struct chunk {
+    chunk* next;
+  };
+
+  struct free_slot {
+    free_slot* next;
+  };
+
+  static constexpr std::size_t round_up(std::size_t n, std::size_t a) {
+    return (n + a - 1) / a * a;
+  }
+
+  std::size_t alignment_;
+  std::size_t slot_size_;
+  std::size_t header_size_;
+  chunk* chunks_ = nullptr;
+  free_slot* free_ = nullptr;
+
+ public:
+  const void* const key;
+  std::unique_ptr<budget_pool> next;
+  allocation_budget_counters counters;
+  // The counters whose `in_use` and `high_water` count the allocations of
+  // this pool, shared by the pools of both kinds of control block for a type
+  // so that their peak is that of all values of the type.
+  allocation_budget_counters* values = &counters;
+
+  budget_pool(const void* k, std::size_t size, std::size_t alignment,
+              std::unique_ptr<budget_pool> n)
+      : alignment_(std::max(alignment, alignof(free_slot))),
+        slot_size_(round_up(std::max(size, sizeof(free_slot)), alignment_)),
+        header_size_(round_up(sizeof(chunk), alignment_)),
+        key(k),
+        next(std::move(n)) {}
+
+  ~budget_pool() {
+    while (chunks_) {
+      auto* c = std::exchange(chunks_, chunks_->next);
+      deallocate_control_block(c, alignment_);
+    }
+  }
+
+  void reserve(std::size_t n) {
+    if (n == 0) {
+      return;
+    }
+    const auto size = header_size_ + n * slot_size_;
+    auto* c = ::new (allocate_control_block(size, alignment_)) chunk{chunks_};
+    chunks_ = c;
+    auto* slots = reinterpret_cast<unsigned char*>(c) + header_size_;
+    for (std::size_t i = n; i-- > 0;) {
+      free_ = ::new (slots + i * slot_size_) free_slot{free_};
+    }
+    counters.reserved += n;
+  }
+
+  void* allocate() noexcept {
+    if (!free_) {
+      ++counters.failures;
+      return nullptr;
+    }
+    void* p = std::exchange(free_, free_->next);
+    values->high_water = std::max(values->high_water, ++values->in_use);
+    return p;
+  }
+
+  void deallocate(void* p) noexcept {
+    free_ = ::new (p) free_slot{free_};
+    --values->in_use;
+  }
+};
+
+}  // end namespace detail
+
+template <class T>
+class budget_allocator;
+
+namespace detail {
+
+template <class U>
+using budget_control_block =
+    allocated_direct_control_block<U, budget_allocator<U>>;
+
+template <class U>
+using budget_pointer_control_block =
+    allocated_pointer_control_block<U, budget_allocator<U>>;
+
+// Storage in an `allocation_budget` is keyed by type. Control blocks are keyed
+// independently of the value type of their allocator, which does not change
+// their size.
+template <class T>
+struct budget_key {
+  static constexpr const void* value = &type_key<T>;
+};
+
+template <class U, class V>
+struct budget_key<allocated_direct_control_block<U, budget_allocator<V>>> {
+  static constexpr const void* value = &type_key<budget_control_block<U>>;
+};
+
+template <class U, class V>
+struct budget_key<allocated_pointer_control_block<U, budget_allocator<V>>> {
+  static constexpr const void* value =
+      &type_key<budget_pointer_control_block<U>>;
+};
+
+}  // end namespace detail
+
+// Storage for the objects and control blocks of `polymorphic_value`s created
+// with a `budget_allocator`, reserved up front for each dynamic type. Once
+// reserved, creating and copying values does not use the global allocator;
+// exhausting the storage for a type throws `allocation_budget_exhausted`, or
+// aborts without exceptions. Not thread-safe.
+class allocation_budget {
+  template <class T>
+  friend class budget_allocator;
+
+  std::unique_ptr<detail::budget_pool> pools_;
+
+  detail::budget_pool* find(const void* key) const noexcept {
+    for (auto* p = pools_.get(); p; p = p->next.get()) {
+      if (p->key == key) {
+        return p;
+      }
+    }
+    return nullptr;
+  }
+
+  template <class U>
+  detail::budget_pool* reserve_pool(std::size_t n) {
+    auto* pool = find(detail::budget_key<U>::value);
+    if (!pool) {
+      pools_ = std::make_unique<detail::budget_pool>(
+          detail::budget_key<U>::value, sizeof(U), alignof(U),
+          std::move(pools_));
+      pool = pools_.get();
+    }
+    pool->reserve(n);
+    return pool;
+  }
+
+  void* allocate(const void* key) {
+    auto* pool = find(key);
+    void* p = pool ? pool->allocate() : nullptr;
+    if (!p) {
+      ISOCPP_P0201_POLYMORPHIC_VALUE_THROW(allocation_budget_exhausted());
+    }
+    return p;
+  }
+
+  void deallocate(const void* key, void* p) noexcept {
+    auto* pool = find(key);
+    assert(pool);
+    pool->deallocate(p);
+  }
+
+ public:
+  allocation_budget() = default;
+  allocation_budget(const allocation_budget&) = delete;
+  allocation_budget& operator=(const allocation_budget&) = delete;
+
+  // Reserves storage for `n` more values owning objects of type `U` created
+  // with `allocate_polymorphic_value` or copied, whose object and control
+  // block share one slot, and for `adopted` more objects of type `U`
+  // allocated by the caller and adopted by the pointer constructor, with
+  // their control blocks.
+  template <class U>
+  void reserve(std::size_t n, std::size_t adopted = 0) {
+    auto* blocks = reserve_pool<detail::budget_control_block<U>>(n);
+    if (adopted > 0) {
+      reserve_pool<U>(adopted);
+      reserve_pool<detail::budget_pointer_control_block<U>>(adopted)->values =
+          &blocks->counters;
+    }
+  }
+
+  // Usage of the storage reserved for values owning objects of type `U`.
+  // `in_use` and `high_water` count values of either kind; `failures` counts
+  // allocations that exceeded the budget.
+  template <class U>
+  allocation_budget_counters counters() const noexcept {
+    allocation_budget_counters c;
+    auto* blocks =
+        find(detail::budget_key<detail::budget_control_block<U>>::value);
+    if (blocks) {
+      c = blocks->counters;
+    }
+    using adopted_block = detail::budget_pointer_control_block<U>;
+    if (auto* adopted = find(detail::budget_key<adopted_block>::value)) {
+      c.failures += adopted->counters.failures;
+    }
+    if (auto* objects = find(detail::budget_key<U>::value)) {
+      c.failures += objects->counters.failures;
+    }
+    return c;
+  }
+};
+
+// Allocator that takes single objects from the storage reserved in an
+// `allocation_budget`. Allocating arrays throws `std::bad_array_new_length`,
+// or aborts without exceptions.
+template <class T>
+class budget_allocator {
+  allocation_budget* budget_;
+
+ public:
+  using value_type = T;
+
+  explicit budget_allocator(allocation_budget& budget) noexcept
+      : budget_(&budget) {}
+
+  template <class U>
+  budget_allocator(const budget_allocator<U>& other) noexcept
+      : budget_(&other.budget()) {}
+
+  T* allocate(std::size_t n) {
+    if (n != 1) {
+      ISOCPP_P0201_POLYMORPHIC_VALUE_THROW(std::bad_array_new_length());
+    }
+    return static_cast<T*>(budget_->allocate(detail::budget_key<T>::value));
+  }
+
+  void deallocate(T* p, std::size_t) noexcept {
+    budget_->deallocate(detail::budget_key<T>::value, p);
+  }
+
+  allocation_budget& budget() const noexcept { return *budget_; }
+};
+
+template <class T, class U>
+bool operator==(const budget_allocator<T>& a,
+                const budget_allocator<U>& b) noexcept {
+  return &a.budget() == &b.budget();
+}
+
+template <class T, class U>
+bool operator!=(const budget_allocator<T>& a,
+                const budget_allocator<U>& b) noexcept {
+  return !(a == b);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// `monotonic_arena` class definition
+////////////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+inline constexpr std::size_t huge_page_size = std::size_t(2) << 20;
+
+// Maps `size` bytes, a multiple of `huge_page_size`, aligned to a huge page
+// and advises the kernel to back them with transparent huge pages. Returns
+// null if huge pages are not supported.
+inline void* map_huge_pages(std::size_t size) noexcept {
+#if defined(ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_MEMORY_MAPPING) && \
+    defined(MADV_HUGEPAGE)
+  void* p = ::mmap(nullptr, size + huge_page_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    return nullptr;
+  }
+  auto begin = reinterpret_cast<std::uintptr_t>(p);
+  auto aligned = (begin + huge_page_size - 1) & ~(huge_page_size - 1);
+  if (aligned != begin) {
+    ::munmap(p, aligned - begin);
+  }
+  if (auto tail = huge_page_size - (aligned - begin)) {
+    ::munmap(reinterpret_cast<void*>(aligned + size), tail);
+  }
+  ::madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+  return reinterpret_cast<void*>(aligned);
+#else
+  (void)size;
+  return nullptr;
+#endif
+}
+
+inline void unmap_huge_pages(void* p, std::size_t size) noexcept {
+#if defined(ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_MEMORY_MAPPING) && \
+    defined(MADV_HUGEPAGE)
+  ::munmap(p, size);
+#else
+  (void)p;
+  (void)size;
+#endif
+}
+
+}  // end namespace detail
+
+// Memory for the objects and control blocks of `polymorphic_value`s created
+// with an `arena_allocator`, handed out by bumping a pointer through a list
+// of chunks. Deallocation does nothing; `reset` makes all memory available
+// again in constant time and `release` returns it. Values created from the
+// arena must be destroyed, or no longer used, before it is reset. Chunks can
+// be backed by transparent huge pages where supported. Not thread-safe.
+class monotonic_arena {
+  struct chunk {
+    chunk* next;
+    std::size_t size;
+    bool mapped;
+  };
+
+  std::size_t chunk_size_;
+  bool huge_pages_;
+  chunk* first_ = nullptr;
+  chunk* current_ = nullptr;
+  unsigned char* ptr_ = nullptr;
+  unsigned char* end_ = nullptr;
+
+  static unsigned char* begin(chunk* c) noexcept {
+    return reinterpret_cast<unsigned char*>(c) + sizeof(chunk);
+  }
+
+  static unsigned char* end(chunk* c) noexcept {
+    return reinterpret_cast<unsigned char*>(c) + c->size;
+  }
+
+  void use(chunk* c) noexcept {
+    current_ = c;
+    ptr_ = begin(c);
+    end_ = end(c);
+  }
+
+  chunk* new_chunk(std::size_t min_size) {
+    auto size = std::max(chunk_size_, min_size + sizeof(chunk));
+    if (huge_pages_) {
+      size = (size + detail::huge_page_size - 1) &
+             ~(detail::huge_page_size - 1);
+      if (void* p = detail::map_huge_pages(size)) {
+        return ::new (p) chunk{nullptr, size, true};
+      }
+    }
+    return ::new (::operator new(size)) chunk{nullptr, size, false};
+  }
+
+  // Moves to a chunk after the current one with room for `size` bytes
+  // aligned to `alignment`, reusing chunks kept by `reset` when possible.
+  void advance(std::size_t size, std::size_t alignment) {
+    auto fits = [&](chunk* c) {
+      auto space = end(c) - begin(c);
+      return std::size_t(space) >= size + alignment;
+    };
+    if (current_ && current_->next && fits(current_->next)) {
+      use(current_->next);
+      return;
+    }
+    auto* c = new_chunk(size + alignment);
+    if (current_) {
+      c->next = current_->next;
+      current_->next = c;
+    } else {
+      c->next = first_;
+      first_ = c;
+    }
+    use(c);
+  }
+
+ public:
+  // Creates an arena that allocates chunks of at least `chunk_size` bytes,
+  // rounded up to huge pages if `huge_pages` is set.
+  explicit monotonic_arena(std::size_t chunk_size = 64 * 1024,
+                           bool huge_pages = false) noexcept
+      : chunk_size_(chunk_size), huge_pages_(huge_pages) {}
+
+  monotonic_arena(const monotonic_arena&) = delete;
+  monotonic_arena& operator=(const monotonic_arena&) = delete;
+
+  ~monotonic_arena() { release(); }
+
+  void* allocate(std::size_t size, std::size_t alignment) {
+    for (;;) {
+      auto p = reinterpret_cast<std::uintptr_t>(ptr_);
+      auto aligned = (p + alignment - 1) & ~(alignment - 1);
+      if (ptr_ && aligned + size <= reinterpret_cast<std::uintptr_t>(end_)) {
+        ptr_ = reinterpret_cast<unsigned char*>(aligned + size);
+        return reinterpret_cast<void*>(aligned);
+      }
+      advance(size, alignment);
+    }
+  }
+
+  // Makes all memory available again, keeping the chunks allocated so far.
+  void reset() noexcept {
+    if (first_) {
+      use(first_);
+    }
+  }
+
+  // Returns all memory.
+  void release() noexcept {
+    while (first_) {
+      auto* c = std::exchange(first_, first_->next);
+      if (c->mapped) {
+        detail::unmap_huge_pages(c, c->size);
+      } else {
+        ::operator delete(c);
+      }
+    }
+    current_ = nullptr;
+    ptr_ = end_ = nullptr;
+  }
+};
+
+// Allocator that takes memory from a `monotonic_arena` and never releases it.
+template <class T>
+class arena_allocator {
+  monotonic_arena* arena_;
+
+ public:
+  using value_type = T;
+
+  explicit arena_allocator(monotonic_arena& arena) noexcept
+      : arena_(&arena) {}
+
+  template <class U>
+  arena_allocator(const arena_allocator<U>& other) noexcept
+      : arena_(&other.arena()) {}
+
+  T* allocate(std::size_t n) {
+    return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T*, std::size_t) noexcept {}
+
+  monotonic_arena& arena() const noexcept { return *arena_; }
+};
+
+template <class T, class U>
+bool operator==(const arena_allocator<T>& a,
+                const arena_allocator<U>& b) noexcept {
+  return &a.arena() == &b.arena();
+}
+
+template <class T, class U>
+bool operator!=(const arena_allocator<T>& a,
+                const arena_allocator<U>& b) noexcept {
+  return !(a == b);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// `small_polymorphic_value` class definition
+////////////////////////////////////////////////////////////////////////////////
+
+// A `polymorphic_value` that stores control blocks for objects of up to
+// `Size` bytes, aligned to at most `Align`, in an inline buffer. Control
+// blocks that are too big or not nothrow-move-constructible are
+// heap-allocated.
+template <class T, std::size_t Size = 3 * sizeof(void*),
+          std::size_t Align = alignof(void*)>
+class small_polymorphic_value {
+  static_assert(!std::is_union<T>::value, "");
+  static_assert(std::is_class<T>::value, "");
+
+  template <class U, std::size_t S, std::size_t A>
+  friend class small_polymorphic_value;
+
+  T* ptr_ = nullptr;
+  detail::control_block* cb_ = nullptr;
+  detail::inline_storage<Size, Align> storage_;
+
+  template <class B, class... Ts>
+  void emplace_control_block(Ts&&... ts) {
+    if constexpr (detail::inline_storage<Size, Align>::template can_hold<B>) {
+      auto* cb = ::new (storage_.data()) B(std::forward<Ts>(ts)...);
+      cb_ = cb;
+      ptr_ = cb->ptr();
+    } else {
+      auto* cb = B::create(std::forward<Ts>(ts)...);
+      cb_ = cb;
+      ptr_ = cb->ptr();
+    }
+  }
+
+  bool is_inline() const noexcept { return storage_.holds(cb_); }
+
+  void reset() noexcept {
+    if (!cb_) {
+      return;
+    }
+    if (is_inline()) {
+      cb_->destroy_in_place();
+    } else {
+      cb_->destroy();
+    }
+    cb_ = nullptr;
+    ptr_ = nullptr;
+  }
+
+  // Takes ownership of the control block of `p`, which is left empty.
+  // `*this` must be empty.
+  template <class U>
+  void take(small_polymorphic_value<U, Size, Align>& p) noexcept {
+    if (!p.cb_) {
+      return;
+    }
+    if (p.is_inline()) {
+      auto offset =
+          detail::subobject_offset(static_cast<T*>(p.ptr_), *p.cb_);
+      cb_ = p.cb_->move_into(storage_.data());
+      ptr_ = detail::subobject_at<T>(*cb_, offset);
+      p.reset();
+    } else {
+      cb_ = std::exchange(p.cb_, nullptr);
+      ptr_ = std::exchange(p.ptr_, nullptr);
+    }
+  }
+
+ public:
+  //
+  // Destructor
+  //
+
+  ~small_polymorphic_value() { reset(); }
+
+  //
+  // Constructors
+  //
+
+  small_polymorphic_value() {}
+
+  template <class U, class C, class D,
+            class = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+  explicit small_polymorphic_value(U* u, C copier, D deleter) {
+    if (!u) {
+      return;
+    }
+
+#ifndef ISOCPP_P0201_POLYMORPHIC_VALUE_NO_RTTI
+    if (std::is_same<D, std::default_delete<U>>::value &&
+        std::is_same<C, default_copy<U>>::value && typeid(*u) != typeid(U))
+      ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTRUCTION_ERROR;
+#endif
+    std::unique_ptr<U, D> p(u, std::move(deleter));
+
+    emplace_control_block<detail::pointer_control_block<U, C, D>>(
+        std::move(p), std::move(copier));
+  }
+
+  template <class U, class C, class D = typename copier_traits<C>::deleter_type,
+            class V = std::enable_if_t<std::is_convertible_v<U*, T*> &&
+                                       std::is_default_constructible_v<D> &&
+                                       !std::is_pointer_v<D>>>
+  explicit small_polymorphic_value(U* u, C copier)
+      : small_polymorphic_value(u, std::move(copier), D{}) {}
+
+  template <
+      class U, class C = default_copy<U>,
+      class D = typename copier_traits<C>::deleter_type,
+      class = std::enable_if_t<
+          std::is_convertible_v<U*, T*> && std::is_default_constructible_v<C> &&
+          std::is_default_constructible_v<D> && !std::is_pointer_v<D>>>
+  explicit small_polymorphic_value(U* u)
+      : small_polymorphic_value(u, C{}, D{}) {}
+
+  //
+  // Copy-constructors
+  //
+
+  small_polymorphic_value(const small_polymorphic_value& p) {
+    if (!p) {
+      return;
+    }
+    auto offset = detail::subobject_offset(p.ptr_, *p.cb_);
+    if (p.is_inline()) {
+      cb_ = p.cb_->clone_into(storage_.data());
+    } else {
+      cb_ = p.cb_->clone();
+    }
+    ptr_ = detail::subobject_at<T>(*cb_, offset);
+  }
+
+  //
+  // Move-constructors
+  //
+
+  small_polymorphic_value(small_polymorphic_value&& p) noexcept { take(p); }
+
+  //
+  // Converting constructors
+  //
+
+  template <class U,
+            class V = std::enable_if_t<!std::is_same<T, U>::value &&
+                                       std::is_convertible<U*, T*>::value>>
+  explicit small_polymorphic_value(
+      const small_polymorphic_value<U, Size, Align>& p)
+      : small_polymorphic_value(small_polymorphic_value<U, Size, Align>(p)) {}
+
+  template <class U,
+            class V = std::enable_if_t<!std::is_same<T, U>::value &&
+                                       std::is_convertible<U*, T*>::value>>
+  explicit small_polymorphic_value(
+      small_polymorphic_value<U, Size, Align>&& p) {
+    take(p);
+  }
+
+  //
+  // In-place constructor
+  //
+
+  template <class U,
+            class V = std::enable_if_t<
+                std::is_convertible<std::decay_t<U>*, T*>::value>,
+            class... Ts>
+  explicit small_polymorphic_value(std::in_place_type_t<U>, Ts&&... ts) {
+    emplace_control_block<detail::direct_control_block<U>>(
+        std::forward<Ts>(ts)...);
+  }
+
+  //
+  // Assignment
+  //
+
+  small_polymorphic_value& operator=(const small_polymorphic_value& p) {
+    if (std::addressof(p) == this) {
+      return *this;
+    }
+    small_polymorphic_value tmp(p);
+    reset();
+    take(tmp);
+    return *this;
+  }
+
+  //
+  // Move-assignment
+  //
+
+  small_polymorphic_value& operator=(small_polymorphic_value&& p) noexcept {
+    if (std::addressof(p) == this) {
+      return *this;
+    }
+    reset();
+    take(p);
+    return *this;
+  }
+
+  //
+  // Modifiers
+  //
+
+  void swap(small_polymorphic_value& p) noexcept {
+    small_polymorphic_value tmp(std::move(p));
+    p.take(*this);
+    take(tmp);
+  }
+
+  //
+  // Observers
+  //
+
+  explicit operator bool() const { return bool(cb_); }
+
+  const T* operator->() const {
+    assert(ptr_);
+    return ptr_;
+  }
+
+  const T& operator*() const {
+    assert(*this);
+    return *ptr_;
+  }
+
+  T* operator->() {
+    assert(*this);
+    return ptr_;
+  }
+
+  T& operator*() {
+    assert(*this);
+    return *ptr_;
+  }
+};
+
+template <class T, std::size_t Size, std::size_t Align>
+void swap(small_polymorphic_value<T, Size, Align>& t,
+          small_polymorphic_value<T, Size, Align>& u) noexcept {
+  t.swap(u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// `inplace_polymorphic_value` class definition
+////////////////////////////////////////////////////////////////////////////////
+
+// A `polymorphic_value` that always stores its object inline and never
+// allocates. Objects must be at most `Size` bytes, aligned to at most `Align`
+// and nothrow-move-constructible.
+template <class T, std::size_t Size,
+          std::size_t Align = alignof(std::max_align_t)>
+class inplace_polymorphic_value {
+  static_assert(!std::is_union<T>::value, "");
+  static_assert(std::is_class<T>::value, "");
+
+  T* ptr_ = nullptr;
+  detail::control_block* cb_ = nullptr;
+  detail::inline_storage<Size, Align> storage_;
 
-  std::unique_ptr<control_block<T>, control_block_deleter> clone()
-      const override {
-    assert(p_);
-    return std::unique_ptr<pointer_control_block, control_block_deleter>(
-        new pointer_control_block(C::operator()(*p_),
-                                  static_cast<const C&>(*this),
-                                  p_.get_deleter()));
+  void reset() noexcept {
+    if (!cb_) {
+      return;
+    }
+    cb_->destroy_in_place();
+    cb_ = nullptr;
+    ptr_ = nullptr;
   }
 
-  T* ptr() override { return p_.get(); }
-};
-
-template <class T, class U>
-class delegating_control_block : public control_block<T> {
-  std::unique_ptr<control_block<U>, control_block_deleter> delegate_;
+  // Takes the object of `p`, which is left empty. `*this` must be empty.
+  void take(inplace_polymorphic_value& p) noexcept {
+    if (!p.cb_) {
+      return;
+    }
+    auto offset = detail::subobject_offset(p.ptr_, *p.cb_);
+    cb_ = p.cb_->move_into(storage_.data());
+    ptr_ = detail::subobject_at<T>(*cb_, offset);
+    p.reset();
+  }
 
  public:
-  explicit delegating_control_block(
-      std::unique_ptr<control_block<U>, control_block_deleter> b)
-      : delegate_(std::move(b)) {}
+  //
+  // Destructor
+  //
 
-  std::unique_ptr<control_block<T>, control_block_deleter> clone()
-      const override {
-    return std::unique_ptr<delegating_control_block, control_block_deleter>(
-        new delegating_control_block(delegate_->clone()));
-  }
+  ~inplace_polymorphic_value() { reset(); }
 
-  T* ptr() override { return delegate_->ptr(); }
-};
+  //
+  // Constructors
+  //
 
-template <typename A>
-struct allocator_wrapper : A {
-  allocator_wrapper(A& a) : A(a) {}
+  inplace_polymorphic_value() {}
 
-  const A& get_allocator() const { return static_cast<const A&>(*this); }
-};
+  //
+  // Copy-constructors
+  //
 
-template <typename T, typename A, typename... Args>
-T* allocate_object(A& a, Args&&... args) {
-  using t_allocator =
-      typename std::allocator_traits<A>::template rebind_alloc<T>;
-  using t_traits = std::allocator_traits<t_allocator>;
-  t_allocator t_alloc(a);
-  T* mem = t_traits::allocate(t_alloc, 1);
-  try {
-    t_traits::construct(t_alloc, mem, std::forward<Args>(args)...);
-    return mem;
-  } catch (...) {
-    t_traits::deallocate(t_alloc, mem, 1);
-    throw;
+  inplace_polymorphic_value(const inplace_polymorphic_value& p) {
+    if (!p) {
+      return;
+    }
+    auto offset = detail::subobject_offset(p.ptr_, *p.cb_);
+    cb_ = p.cb_->clone_into(storage_.data());
+    ptr_ = detail::subobject_at<T>(*cb_, offset);
   }
-}
 
-template <typename T, typename A>
-void deallocate_object(A& a, T* p) {
-  using t_allocator =
-      typename std::allocator_traits<A>::template rebind_alloc<T>;
-  using t_traits = std::allocator_traits<t_allocator>;
-  t_allocator t_alloc(a);
-  t_traits::destroy(t_alloc, p);
-  t_traits::deallocate(t_alloc, p, 1);
-}
+  //
+  // Move-constructors
+  //
 
-template <class T, class U, class A>
-class allocated_pointer_control_block : public control_block<T>,
-                                        allocator_wrapper<A> {
-  U* p_;
+  inplace_polymorphic_value(inplace_polymorphic_value&& p) noexcept {
+    take(p);
+  }
 
- public:
-  explicit allocated_pointer_control_block(U* u, A a)
-      : allocator_wrapper<A>(a), p_(u) {}
+  //
+  // In-place constructor
+  //
 
-  ~allocated_pointer_control_block() {
-    detail::deallocate_object(this->get_allocator(), p_);
+  template <class U,
+            class V = std::enable_if_t<
+                std::is_convertible<std::decay_t<U>*, T*>::value>,
+            class... Ts>
+  explicit inplace_polymorphic_value(std::in_place_type_t<U>, Ts&&... ts) {
+    using block = detail::direct_control_block<U>;
+    static_assert(sizeof(U) <= Size && alignof(U) <= Align,
+                  "Object is too large for inplace_polymorphic_value");
+    static_assert(std::is_nothrow_move_constructible<U>::value,
+                  "Object must be nothrow-move-constructible");
+    static_assert(
+        detail::inline_storage<Size, Align>::template can_hold<block>, "");
+    auto* cb = ::new (storage_.data()) block(std::forward<Ts>(ts)...);
+    cb_ = cb;
+    ptr_ = cb->ptr();
   }
 
-  std::unique_ptr<control_block<T>, control_block_deleter> clone()
-      const override {
-    assert(p_);
+  //
+  // Assignment
+  //
 
-    auto* cloned_ptr = detail::allocate_object<U>(this->get_allocator(), *p_);
-    try {
-      auto* new_cb = detail::allocate_object<allocated_pointer_control_block>(
-          this->get_allocator(), cloned_ptr, this->get_allocator());
-      return std::unique_ptr<control_block<T>, control_block_deleter>(new_cb);
-    } catch (...) {
-      detail::deallocate_object(this->get_allocator(), cloned_ptr);
-      throw;
+  inplace_polymorphic_value& operator=(const inplace_polymorphic_value& p) {
+    if (std::addressof(p) == this) {
+      return *this;
     }
+    inplace_polymorphic_value tmp(p);
+    reset();
+    take(tmp);
+    return *this;
   }
 
-  T* ptr() override { return p_; }
+  //
+  // Move-assignment
+  //
 
-  void destroy() noexcept override {
-    detail::deallocate_object(this->get_allocator(), this);
+  inplace_polymorphic_value& operator=(inplace_polymorphic_value&& p) noexcept {
+    if (std::addressof(p) == this) {
+      return *this;
+    }
+    reset();
+    take(p);
+    return *this;
   }
-};
 
-}  // end namespace detail
+  //
+  // Modifiers
+  //
 
-template <class T>
-struct default_copy {
-  using deleter_type = std::default_delete<T>;
-  T* operator()(const T& t) const { return new T(t); }
-};
+  void swap(inplace_polymorphic_value& p) noexcept {
+    inplace_polymorphic_value tmp(std::move(p));
+    p.take(*this);
+    take(tmp);
+  }
 
-template <class T>
-struct copier_traits : detail::copier_traits_deleter_base<T, void> {};
+  //
+  // Observers
+  //
 
-class bad_polymorphic_value_construction : public std::exception {
- public:
-  bad_polymorphic_value_construction() noexcept = default;
+  explicit operator bool() const { return bool(cb_); }
 
-  const char* what() const noexcept override {
-    return "Dynamic and static type mismatch in polymorphic_value "
-           "construction";
+  const T* operator->() const {
+    assert(ptr_);
+    return ptr_;
   }
-};
 
-template <class T>
-class polymorphic_value;
+  const T& operator*() const {
+    assert(*this);
+    return *ptr_;
+  }
 
-template <class T>
-struct is_polymorphic_value : std::false_type {};
+  T* operator->() {
+    assert(*this);
+    return ptr_;
+  }
 
-template <class T>
-struct is_polymorphic_value<polymorphic_value<T>> : std::true_type {};
+  T& operator*() {
+    assert(*this);
+    return *ptr_;
+  }
+};
+
+template <class T, std::size_t Size, std::size_t Align>
+void swap(inplace_polymorphic_value<T, Size, Align>& t,
+          inplace_polymorphic_value<T, Size, Align>& u) noexcept {
+  t.swap(u);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
-// `polymorphic_value` class definition
+// `compact_polymorphic_value` class definition
 ////////////////////////////////////////////////////////////////////////////////
 
+namespace detail {
+
+// Owns a control block together with a recorded pointer to a base subobject
+// of its object. Used by `compact_polymorphic_value` when the base subobject
+// cannot be found from the control block alone.
+struct compact_node {
+  control_block_ptr cb;
+  void* ptr;
+};
+
+}  // end namespace detail
+
+// A `polymorphic_value` that is the size of a single pointer. The pointer
+// refers to the control block and its low bits record how to find the owned
+// `T` from it: at a fixed offset after the control block header, at the
+// start of the owned object, or through a separately allocated node.
 template <class T>
-class polymorphic_value {
+class compact_polymorphic_value {
   static_assert(!std::is_union<T>::value, "");
   static_assert(std::is_class<T>::value, "");
 
   template <class U>
-  friend class polymorphic_value;
+  friend class compact_polymorphic_value;
 
-  template <class T_, class U, class... Ts>
-  friend polymorphic_value<T_> make_polymorphic_value(Ts&&... ts);
+  enum : std::uintptr_t {
+    inline_object = 0,
+    type_erased_object = 1,
+    recorded_object = 2,
+    mode_mask = 3
+  };
 
-  template <class T_, class U, class A, class... Ts>
-  friend polymorphic_value<T_> allocate_polymorphic_value(std::allocator_arg_t,
-                                                          A& a, Ts&&... ts);
+  static_assert(alignof(detail::control_block) > mode_mask, "");
+  static_assert(alignof(detail::compact_node) > mode_mask, "");
 
-  T* ptr_ = nullptr;
-  std::unique_ptr<detail::control_block<T>, detail::control_block_deleter> cb_;
+  std::uintptr_t bits_ = 0;
+
+  std::uintptr_t mode() const noexcept { return bits_ & mode_mask; }
+
+  void* address() const noexcept {
+    return reinterpret_cast<void*>(bits_ & ~std::uintptr_t(mode_mask));
+  }
+
+  detail::control_block* block() const noexcept {
+    if (mode() == recorded_object) {
+      return static_cast<detail::compact_node*>(address())->cb.get();
+    }
+    return static_cast<detail::control_block*>(address());
+  }
+
+  T* get() const noexcept {
+    if (!bits_) {
+      return nullptr;
+    }
+    switch (mode()) {
+      case inline_object:
+        return reinterpret_cast<T*>(static_cast<char*>(address()) +
+                                    sizeof(detail::control_block));
+      case type_erased_object:
+        return static_cast<T*>(block()->object());
+      default:
+        return static_cast<T*>(
+            static_cast<detail::compact_node*>(address())->ptr);
+    }
+  }
+
+  // Takes ownership of `cb`, whose object has `ptr` as its `T` subobject.
+  // `*this` must be empty.
+  void adopt(detail::control_block_ptr cb, T* ptr) {
+    if (!cb) {
+      return;
+    }
+    auto* header = reinterpret_cast<char*>(cb.get());
+    auto* object = reinterpret_cast<char*>(ptr);
+    if (object == header + sizeof(detail::control_block)) {
+      bits_ = reinterpret_cast<std::uintptr_t>(cb.release()) | inline_object;
+    } else if (object == static_cast<char*>(cb->object())) {
+      bits_ =
+          reinterpret_cast<std::uintptr_t>(cb.release()) | type_erased_object;
+    } else {
+      auto* node = ::new (detail::allocate_control_block(
+          sizeof(detail::compact_node), alignof(detail::compact_node)))
+          detail::compact_node{std::move(cb), ptr};
+      bits_ = reinterpret_cast<std::uintptr_t>(node) | recorded_object;
+    }
+  }
+
+  void reset() noexcept {
+    if (!bits_) {
+      return;
+    }
+    if (mode() == recorded_object) {
+      auto* node = static_cast<detail::compact_node*>(address());
+      node->~compact_node();
+      detail::deallocate_control_block(node, alignof(detail::compact_node));
+    } else {
+      detail::control_block_deleter{}(block());
+    }
+    bits_ = 0;
+  }
 
  public:
   //
   // Destructor
   //
 
-  ~polymorphic_value() = default;
+  ~compact_polymorphic_value() { reset(); }
 
   //
   // Constructors
   //
 
-  polymorphic_value() {}
+  compact_polymorphic_value() {}
 
   template <class U, class C, class D,
             class = std::enable_if_t<std::is_convertible_v<U*, T*>>>
-  explicit polymorphic_value(U* u, C copier, D deleter) {
+  explicit compact_polymorphic_value(U* u, C copier, D deleter) {
     if (!u) {
       return;
     }
@@ -273,23 +3532,22 @@ class polymorphic_value {
 #ifndef ISOCPP_P0201_POLYMORPHIC_VALUE_NO_RTTI
     if (std::is_same<D, std::default_delete<U>>::value &&
         std::is_same<C, default_copy<U>>::value && typeid(*u) != typeid(U))
-      throw bad_polymorphic_value_construction();
+      ISOCPP_P0201_POLYMORPHIC_VALUE_CONSTRUCTION_ERROR;
 #endif
     std::unique_ptr<U, D> p(u, std::move(deleter));
 
-    cb_ = std::unique_ptr<detail::pointer_control_block<T, U, C, D>,
-                          detail::control_block_deleter>(
-        new detail::pointer_control_block<T, U, C, D>(std::move(p),
-                                                      std::move(copier)));
-    ptr_ = u;
+    adopt(detail::control_block_ptr(
+              detail::pointer_control_block<U, C, D>::create(
+                  std::move(p), std::move(copier))),
+          u);
   }
 
   template <class U, class C, class D = typename copier_traits<C>::deleter_type,
             class V = std::enable_if_t<std::is_convertible_v<U*, T*> &&
                                        std::is_default_constructible_v<D> &&
                                        !std::is_pointer_v<D>>>
-  explicit polymorphic_value(U* u, C copier)
-      : polymorphic_value(u, std::move(copier), D{}) {}
+  explicit compact_polymorphic_value(U* u, C copier)
+      : compact_polymorphic_value(u, std::move(copier), D{}) {}
 
   template <
       class U, class C = default_copy<U>,
@@ -297,48 +3555,30 @@ class polymorphic_value {
       class = std::enable_if_t<
           std::is_convertible_v<U*, T*> && std::is_default_constructible_v<C> &&
           std::is_default_constructible_v<D> && !std::is_pointer_v<D>>>
-  explicit polymorphic_value(U* u) : polymorphic_value(u, C{}, D{}) {}
-
-  template <class U, class A,
-            class = std::enable_if_t<std::is_convertible_v<U*, T*>>>
-  explicit polymorphic_value(U* u, std::allocator_arg_t, const A& alloc) {
-    if (!u) {
-      return;
-    }
-
-#ifndef ISOCPP_P0201_POLYMORPHIC_VALUE_NO_RTTI
-    if (typeid(*u) != typeid(U)) throw bad_polymorphic_value_construction();
-#endif
-
-    cb_ = std::unique_ptr<detail::allocated_pointer_control_block<T, U, A>,
-                          detail::control_block_deleter>(
-        detail::allocate_object<
-            detail::allocated_pointer_control_block<T, U, A>>(alloc, u, alloc));
-    ptr_ = u;
-  }
+  explicit compact_polymorphic_value(U* u)
+      : compact_polymorphic_value(u, C{}, D{}) {}
 
   //
   // Copy-constructors
   //
 
-  polymorphic_value(const polymorphic_value& p) {
+  compact_polymorphic_value(const compact_polymorphic_value& p) {
     if (!p) {
       return;
     }
-    auto tmp_cb = p.cb_->clone();
-    ptr_ = tmp_cb->ptr();
-    cb_ = std::move(tmp_cb);
+    auto* cb = p.block();
+    detail::control_block_ptr tmp_cb(cb->clone());
+    auto* ptr = detail::subobject_at<T>(
+        *tmp_cb, detail::subobject_offset(p.get(), *cb));
+    adopt(std::move(tmp_cb), ptr);
   }
 
   //
   // Move-constructors
   //
 
-  polymorphic_value(polymorphic_value&& p) noexcept {
-    ptr_ = p.ptr_;
-    cb_ = std::move(p.cb_);
-    p.ptr_ = nullptr;
-  }
+  compact_polymorphic_value(compact_polymorphic_value&& p) noexcept
+      : bits_(std::exchange(p.bits_, 0)) {}
 
   //
   // Converting constructors
@@ -347,23 +3587,26 @@ class polymorphic_value {
   template <class U,
             class V = std::enable_if_t<!std::is_same<T, U>::value &&
                                        std::is_convertible<U*, T*>::value>>
-  explicit polymorphic_value(const polymorphic_value<U>& p) {
-    polymorphic_value<U> tmp(p);
-    ptr_ = tmp.ptr_;
-    cb_ = std::unique_ptr<detail::delegating_control_block<T, U>,
-                          detail::control_block_deleter>(
-        new detail::delegating_control_block<T, U>(std::move(tmp.cb_)));
-  }
+  explicit compact_polymorphic_value(const compact_polymorphic_value<U>& p)
+      : compact_polymorphic_value(compact_polymorphic_value<U>(p)) {}
 
   template <class U,
             class V = std::enable_if_t<!std::is_same<T, U>::value &&
                                        std::is_convertible<U*, T*>::value>>
-  explicit polymorphic_value(polymorphic_value<U>&& p) {
-    ptr_ = p.ptr_;
-    cb_ = std::unique_ptr<detail::delegating_control_block<T, U>,
-                          detail::control_block_deleter>(
-        new detail::delegating_control_block<T, U>(std::move(p.cb_)));
-    p.ptr_ = nullptr;
+  explicit compact_polymorphic_value(compact_polymorphic_value<U>&& p) {
+    if (!p) {
+      return;
+    }
+    T* ptr = p.get();
+    if (p.mode() == recorded_object) {
+      // Reuse the node of `p`, rebased onto the `T` subobject.
+      static_cast<detail::compact_node*>(p.address())->ptr = ptr;
+      bits_ = std::exchange(p.bits_, 0);
+      return;
+    }
+    detail::control_block_ptr cb(p.block());
+    p.bits_ = 0;
+    adopt(std::move(cb), ptr);
   }
 
   //
@@ -372,34 +3615,24 @@ class polymorphic_value {
 
   template <class U,
             class V = std::enable_if_t<
-                std::is_convertible<std::decay_t<U>*, T*>::value &&
-                !is_polymorphic_value<std::decay_t<U>>::value>,
+                std::is_convertible<std::decay_t<U>*, T*>::value>,
             class... Ts>
-  explicit polymorphic_value(std::in_place_type_t<U>, Ts&&... ts)
-      : cb_(std::unique_ptr<detail::direct_control_block<T, U>,
-                            detail::control_block_deleter>(
-            new detail::direct_control_block<T, U>(std::forward<Ts>(ts)...))) {
-    ptr_ = cb_->ptr();
+  explicit compact_polymorphic_value(std::in_place_type_t<U>, Ts&&... ts) {
+    auto* cb =
+        detail::direct_control_block<U>::create(std::forward<Ts>(ts)...);
+    adopt(detail::control_block_ptr(cb), cb->ptr());
   }
 
   //
   // Assignment
   //
 
-  polymorphic_value& operator=(const polymorphic_value& p) {
+  compact_polymorphic_value& operator=(const compact_polymorphic_value& p) {
     if (std::addressof(p) == this) {
       return *this;
     }
-
-    if (!p) {
-      cb_.reset();
-      ptr_ = nullptr;
-      return *this;
-    }
-
-    auto tmp_cb = p.cb_->clone();
-    ptr_ = tmp_cb->ptr();
-    cb_ = std::move(tmp_cb);
+    compact_polymorphic_value tmp(p);
+    swap(tmp);
     return *this;
   }
 
@@ -407,14 +3640,12 @@ class polymorphic_value {
   // Move-assignment
   //
 
-  polymorphic_value& operator=(polymorphic_value&& p) noexcept {
+  compact_polymorphic_value& operator=(compact_polymorphic_value&& p) noexcept {
     if (std::addressof(p) == this) {
       return *this;
     }
-
-    cb_ = std::move(p.cb_);
-    ptr_ = p.ptr_;
-    p.ptr_ = nullptr;
+    reset();
+    bits_ = std::exchange(p.bits_, 0);
     return *this;
   }
 
@@ -422,76 +3653,121 @@ class polymorphic_value {
   // Modifiers
   //
 
-  void swap(polymorphic_value& p) noexcept {
+  void swap(compact_polymorphic_value& p) noexcept {
     using std::swap;
-    swap(ptr_, p.ptr_);
-    swap(cb_, p.cb_);
+    swap(bits_, p.bits_);
   }
 
   //
   // Observers
   //
 
-  explicit operator bool() const { return bool(cb_); }
+  explicit operator bool() const { return bits_ != 0; }
 
   const T* operator->() const {
-    assert(ptr_);
-    return ptr_;
+    assert(*this);
+    return get();
   }
 
   const T& operator*() const {
     assert(*this);
-    return *ptr_;
+    return *get();
   }
 
   T* operator->() {
     assert(*this);
-    return ptr_;
+    return get();
   }
 
   T& operator*() {
     assert(*this);
-    return *ptr_;
+    return *get();
   }
 };
 
-//
-// polymorphic_value creation
-//
-template <class T, class U = T, class... Ts>
-polymorphic_value<T> make_polymorphic_value(Ts&&... ts) {
-  polymorphic_value<T> p;
-  p.cb_ = std::unique_ptr<detail::direct_control_block<T, U>,
-                          detail::control_block_deleter>(
-      new detail::direct_control_block<T, U>(std::forward<Ts>(ts)...));
-  p.ptr_ = p.cb_->ptr();
-  return p;
+template <class T>
+void swap(compact_polymorphic_value<T>& t,
+          compact_polymorphic_value<T>& u) noexcept {
+  t.swap(u);
 }
 
-template <class T, class U = T, class A = std::allocator<U>, class... Ts>
-polymorphic_value<T> allocate_polymorphic_value(std::allocator_arg_t, A& a,
-                                                Ts&&... ts) {
-  polymorphic_value<T> p;
-  auto* u = detail::allocate_object<U>(a, std::forward<Ts>(ts)...);
-  try {
-    p.cb_ = std::unique_ptr<detail::allocated_pointer_control_block<T, U, A>,
-                            detail::control_block_deleter>(
-        detail::allocate_object<
-            detail::allocated_pointer_control_block<T, U, A>>(a, u, a));
-  } catch (...) {
-    detail::deallocate_object(a, u);
-    throw;
-  }
-  p.ptr_ = p.cb_->ptr();
-  return p;
+////////////////////////////////////////////////////////////////////////////////
+// Relocation
+////////////////////////////////////////////////////////////////////////////////
+
+// Specialize as `std::true_type` for types whose objects can be relocated,
+// that is moved from and then destroyed, by copying their bytes.
+template <class T>
+struct is_trivially_relocatable
+    : std::bool_constant<std::is_trivially_copyable<T>::value> {};
+
+// Handles that own their object through pointers hold no pointers into
+// themselves. `small_polymorphic_value` and `inplace_polymorphic_value` may
+// point into their own storage and are not trivially relocatable.
+template <class T>
+struct is_trivially_relocatable<polymorphic_value<T>> : std::true_type {};
+
+template <class T>
+struct is_trivially_relocatable<compact_polymorphic_value<T>>
+    : std::true_type {};
+
+template <class T>
+inline constexpr bool is_trivially_relocatable_v =
+    is_trivially_relocatable<T>::value;
+
+// Relocates the objects in `[first, last)` to the uninitialized storage at
+// `d_first` and returns the end of the relocated range. The objects in
+// `[first, last)` are left destroyed. The ranges may overlap only if `T` is
+// trivially relocatable.
+template <class T>
+T* uninitialized_relocate(T* first, T* last, T* d_first) noexcept(
+    is_trivially_relocatable_v<T> ||
+    std::is_nothrow_move_constructible<T>::value) {
+  if constexpr (is_trivially_relocatable_v<T>) {
+    const auto n = static_cast<std::size_t>(last - first);
+    if (n != 0) {
+      std::memmove(static_cast<void*>(d_first), static_cast<void*>(first),
+                   n * sizeof(T));
+    }
+    return d_first + n;
+  } else {
+    for (; first != last; ++first, ++d_first) {
+      ::new (static_cast<void*>(d_first)) T(std::move(*first));
+      first->~T();
+    }
+    return d_first;
+  }
 }
 
-//
-// non-member swap
-//
+namespace detail {
+
+// Raw bytes of a relocated `T`. Sorting slots moves objects with `memcpy`.
 template <class T>
-void swap(polymorphic_value<T>& t, polymorphic_value<T>& u) noexcept {
-  t.swap(u);
+struct relocation_slot {
+  alignas(T) unsigned char bytes[sizeof(T)];
+
+  const T& object() const noexcept {
+    return *std::launder(reinterpret_cast<const T*>(bytes));
+  }
+};
+
+}  // end namespace detail
+
+// Sorts `[first, last)` with `comp` like `std::sort`. Trivially relocatable
+// objects are rearranged by copying their bytes rather than by move
+// construction and assignment.
+template <class T, class Compare = std::less<>>
+void relocating_sort(T* first, T* last, Compare comp = Compare{}) {
+  if constexpr (is_trivially_relocatable_v<T>) {
+    using slot = detail::relocation_slot<T>;
+    static_assert(sizeof(slot) == sizeof(T), "");
+    std::sort(reinterpret_cast<slot*>(first), reinterpret_cast<slot*>(last),
+              [&comp](const slot& a, const slot& b) {
+                return comp(a.object(), b.object());
+              });
+  } else {
+    std::sort(first, last, std::move(comp));
+  }
 }
 
 }  // namespace isocpp_p0201
@@ -0,0 +1,380 @@
+/* Copyright (c) 2016 The Polymorphic Value Authors. All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+==============================================================================*/
+
+#include "polymorphic_value.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+namespace {
+
+// The virtual-dispatch control block used before control blocks were given
+// function-pointer tables, kept as a baseline for comparison.
+namespace virtual_dispatch {
+
+template <class T>
+struct control_block {
+  virtual ~control_block() = default;
+  virtual std::unique_ptr<control_block> clone() const = 0;
+  virtual T* ptr() = 0;
+};
+
+template <class T, class U>
+class direct_control_block : public control_block<T> {
+  U u_;
+
+ public:
+  template <class... Ts>
+  explicit direct_control_block(Ts&&... ts) : u_(std::forward<Ts>(ts)...) {}
+
+  std::unique_ptr<control_block<T>> clone() const override {
+    return std::make_unique<direct_control_block>(*this);
+  }
+
+  T* ptr() override { return &u_; }
+};
+
+template <class T>
+class polymorphic_value {
+  T* ptr_ = nullptr;
+  std::unique_ptr<control_block<T>> cb_;
+
+ public:
+  template <class U, class... Ts>
+  explicit polymorphic_value(std::in_place_type_t<U>, Ts&&... ts)
+      : cb_(std::make_unique<direct_control_block<T, U>>(
+            std::forward<Ts>(ts)...)) {
+    ptr_ = cb_->ptr();
+  }
+
+  polymorphic_value(const polymorphic_value& p) {
+    if (!p.cb_) {
+      return;
+    }
+    auto cb = p.cb_->clone();
+    ptr_ = cb->ptr();
+    cb_ = std::move(cb);
+  }
+
+  polymorphic_value(polymorphic_value&& p) noexcept
+      : ptr_(std::exchange(p.ptr_, nullptr)), cb_(std::move(p.cb_)) {}
+
+  T* operator->() { return ptr_; }
+};
+
+}  // namespace virtual_dispatch
+
+struct Shape {
+  virtual ~Shape() = default;
+  virtual double area() const = 0;
+};
+
+struct Circle : Shape {
+  double r_;
+  explicit Circle(double r) : r_(r) {}
+  double area() const override { return 3.14159 * r_ * r_; }
+};
+
+struct Rectangle : Shape {
+  double w_, h_;
+  explicit Rectangle(double s) : w_(s), h_(2 * s) {}
+  double area() const override { return w_ * h_; }
+};
+
+struct Polygon : Shape {
+  double xs_[8] = {};
+  explicit Polygon(double s) { xs_[0] = s; }
+  double area() const override { return xs_[0]; }
+};
+
+constexpr std::size_t batch_size = 4096;
+
+template <class Value>
+std::vector<Value> make_shapes(std::size_t n) {
+  std::vector<Value> shapes;
+  shapes.reserve(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    switch (i % 3) {
+      case 0:
+        shapes.emplace_back(std::in_place_type<Circle>, double(i));
+        break;
+      case 1:
+        shapes.emplace_back(std::in_place_type<Rectangle>, double(i));
+        break;
+      default:
+        shapes.emplace_back(std::in_place_type<Polygon>, double(i));
+        break;
+    }
+  }
+  return shapes;
+}
+
+template <class Value>
+void BM_Copy(benchmark::State& state) {
+  const auto shapes = make_shapes<Value>(batch_size);
+  std::vector<Value> copies;
+  copies.reserve(batch_size);
+  for (auto _ : state) {
+    for (const auto& shape : shapes) {
+      copies.push_back(shape);
+    }
+    benchmark::DoNotOptimize(copies.data());
+    state.PauseTiming();
+    copies.clear();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * batch_size);
+}
+
+template <class Value>
+void BM_Destroy(benchmark::State& state) {
+  const auto shapes = make_shapes<Value>(batch_size);
+  std::vector<Value> copies;
+  copies.reserve(batch_size);
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (const auto& shape : shapes) {
+      copies.push_back(shape);
+    }
+    state.ResumeTiming();
+    copies.clear();
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * batch_size);
+}
+
+struct Message {
+  int kind = 0;
+};
+
+struct Payload : Message {
+  int data[14] = {};
+  explicit Payload(int v) { data[0] = v; }
+};
+
+void BM_CopyTriviallyCopyable(benchmark::State& state) {
+  std::vector<isocpp_p0201::polymorphic_value<Message>> messages;
+  messages.reserve(batch_size);
+  for (std::size_t i = 0; i < batch_size; ++i) {
+    messages.emplace_back(std::in_place_type<Payload>, int(i));
+  }
+  std::vector<isocpp_p0201::polymorphic_value<Message>> copies;
+  copies.reserve(batch_size);
+  for (auto _ : state) {
+    copies.assign(messages.begin(), messages.end());
+    benchmark::DoNotOptimize(copies.data());
+    state.PauseTiming();
+    copies.clear();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * batch_size);
+}
+
+constexpr std::size_t relocation_size = 10'000'000;
+
+// Minimal growable array that relocates its elements on reallocation, for
+// comparison with `std::vector`.
+template <class T>
+class relocating_buffer {
+  T* data_ = nullptr;
+  std::size_t size_ = 0;
+  std::size_t capacity_ = 0;
+
+ public:
+  relocating_buffer() = default;
+  relocating_buffer(const relocating_buffer&) = delete;
+  relocating_buffer& operator=(const relocating_buffer&) = delete;
+
+  ~relocating_buffer() {
+    clear();
+    std::free(data_);
+  }
+
+  void push_back(T&& t) {
+    if (size_ == capacity_) {
+      const auto capacity = capacity_ ? 2 * capacity_ : 1;
+      auto* data = static_cast<T*>(std::malloc(capacity * sizeof(T)));
+      if (!data) {
+        throw std::bad_alloc();
+      }
+      isocpp_p0201::uninitialized_relocate(data_, data_ + size_, data);
+      std::free(data_);
+      data_ = data;
+      capacity_ = capacity;
+    }
+    ::new (static_cast<void*>(data_ + size_)) T(std::move(t));
+    ++size_;
+  }
+
+  void clear() noexcept {
+    std::destroy(data_, data_ + size_);
+    size_ = 0;
+  }
+
+  T* data() noexcept { return data_; }
+
+  T& operator[](std::size_t i) noexcept { return data_[i]; }
+
+  std::size_t size() const noexcept { return size_; }
+};
+
+// Appends `relocation_size` handles, one at a time, to an empty container.
+template <class Container>
+void BM_PushBackGrowth(benchmark::State& state) {
+  using value = isocpp_p0201::polymorphic_value<Shape>;
+  auto shapes = make_shapes<value>(relocation_size);
+  for (auto _ : state) {
+    Container grown;
+    for (auto& shape : shapes) {
+      grown.push_back(std::move(shape));
+    }
+    benchmark::DoNotOptimize(grown.data());
+    state.PauseTiming();
+    for (std::size_t i = 0; i < relocation_size; ++i) {
+      shapes[i] = std::move(grown[i]);
+    }
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * relocation_size);
+}
+
+// Sorts `relocation_size` shuffled handles by the address of their object,
+// so that the comparison does not dominate.
+template <bool Relocating>
+void BM_Sort(benchmark::State& state) {
+  using value = isocpp_p0201::polymorphic_value<Shape>;
+  auto shapes = make_shapes<value>(relocation_size);
+  auto by_address = [](const value& a, const value& b) {
+    return std::less<const Shape*>{}(a.operator->(), b.operator->());
+  };
+  std::mt19937 random(42);
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::shuffle(shapes.begin(), shapes.end(), random);
+    state.ResumeTiming();
+    if constexpr (Relocating) {
+      isocpp_p0201::relocating_sort(shapes.data(),
+                                    shapes.data() + shapes.size(), by_address);
+    } else {
+      std::sort(shapes.begin(), shapes.end(), by_address);
+    }
+    benchmark::DoNotOptimize(shapes.data());
+  }
+  state.SetItemsProcessed(state.iterations() * relocation_size);
+}
+
+struct PooledCircle : Circle {
+  using Circle::Circle;
+};
+
+// A shape carrying a large embedded buffer, such as a model snapshot.
+template <bool Mapped>
+struct Snapshot : Shape {
+  static constexpr std::size_t size = std::size_t(64) << 20;
+
+  unsigned char data_[size];
+
+  explicit Snapshot(double) { std::memset(data_, 1, size); }
+
+  double area() const override { return data_[0]; }
+};
+
+}  // namespace
+
+namespace isocpp_p0201 {
+template <>
+struct uses_control_block_pool<PooledCircle> : std::true_type {};
+
+template <>
+struct uses_large_object_storage<Snapshot<true>> : std::true_type {};
+}  // namespace isocpp_p0201
+
+namespace {
+
+// Each thread clones batches of values and swaps them through a shared
+// mailbox for a batch cloned by another thread, which it destroys, so that
+// control blocks are mostly freed on a different thread from the one that
+// allocated them.
+template <class U>
+void BM_CrossThreadClone(benchmark::State& state) {
+  using value = isocpp_p0201::polymorphic_value<Shape>;
+  using batch = std::vector<value>;
+  constexpr std::size_t batch_length = 64;
+  static std::atomic<batch*> mailbox{nullptr};
+
+  const value prototype(std::in_place_type<U>, 1.0);
+  for (auto _ : state) {
+    auto* cloned = new batch(batch_length, prototype);
+    delete mailbox.exchange(cloned, std::memory_order_acq_rel);
+  }
+  // The last exchange of every thread empties the mailbox.
+  delete mailbox.exchange(nullptr, std::memory_order_acq_rel);
+  state.SetItemsProcessed(state.iterations() * batch_length);
+}
+
+// Copies a large object, writes one byte of the copy and destroys it.
+template <class U>
+void BM_LargeObjectClone(benchmark::State& state) {
+  using value = isocpp_p0201::polymorphic_value<Shape>;
+  const value prototype(std::in_place_type<U>, 1.0);
+  for (auto _ : state) {
+    value copy(prototype);
+    static_cast<U&>(*copy).data_[0] = 2;
+    benchmark::DoNotOptimize(&*copy);
+  }
+  state.SetBytesProcessed(state.iterations() * U::size);
+}
+
+}  // namespace
+
+BENCHMARK(BM_CopyTriviallyCopyable);
+BENCHMARK_TEMPLATE(BM_PushBackGrowth,
+                   std::vector<isocpp_p0201::polymorphic_value<Shape>>)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_PushBackGrowth,
+                   relocating_buffer<isocpp_p0201::polymorphic_value<Shape>>)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Sort, false)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Sort, true)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Copy, virtual_dispatch::polymorphic_value<Shape>);
+BENCHMARK_TEMPLATE(BM_Copy, isocpp_p0201::polymorphic_value<Shape>);
+BENCHMARK_TEMPLATE(BM_Destroy, virtual_dispatch::polymorphic_value<Shape>);
+BENCHMARK_TEMPLATE(BM_Destroy, isocpp_p0201::polymorphic_value<Shape>);
+BENCHMARK_TEMPLATE(BM_CrossThreadClone, Circle)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_CrossThreadClone, PooledCircle)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_LargeObjectClone, Snapshot<false>)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_LargeObjectClone, Snapshot<true>)
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
@@ -20,9 +20,18 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include "polymorphic_value.h"
 
+#include <cstdlib>
+#include <memory>
 #include <new>
 #include <stdexcept>
+#include <thread>
 #include <utility>
+#include <vector>
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_LARGE_OBJECTS
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 #define CATCH_CONFIG_MAIN
 #include "catch2/catch.hpp"
@@ -59,8 +68,38 @@ struct DerivedType : BaseType {
 
 size_t DerivedType::object_count = 0;
 
+size_t allocation_count = 0;
+
+bool fail_allocations = false;
+
+// Kept out of line so that GCC does not see the replacement operator delete
+// passing memory from operator new to free (-Wmismatched-new-delete).
+[[gnu::noinline]] void release(void* p) noexcept { std::free(p); }
+
 }  // namespace
 
+void* operator new(std::size_t size) {
+  ++allocation_count;
+  if (!fail_allocations) {
+    if (void* p = std::malloc(size ? size : 1)) {
+      return p;
+    }
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return operator new(size);
+  } catch (const std::bad_alloc&) {
+    return nullptr;
+  }
+}
+
+void operator delete(void* p) noexcept { release(p); }
+
+void operator delete(void* p, std::size_t) noexcept { release(p); }
+
 TEST_CASE("Support for incomplete types", "[polymorphic_value.class]") {
   class Incomplete;
   polymorphic_value<Incomplete> p;
@@ -179,6 +218,66 @@ TEST_CASE("polymorphic_value constructed with copier and deleter",
   REQUIRE(deletion_count == 1);
 }
 
+namespace {
+struct counting_copier {
+  size_t* copies;
+
+  DerivedType* operator()(const DerivedType& d) const {
+    ++*copies;
+    return new DerivedType(d);
+  }
+
+  DerivedType* copy_into(const DerivedType& d, void* storage) const {
+    ++*copies;
+    return ::new (storage) DerivedType(d);
+  }
+};
+}  // namespace
+
+TEST_CASE("Copies of values adopted from pointers",
+          "[polymorphic_value.constructor]") {
+  GIVEN("A value adopted with default_copy") {
+    polymorphic_value<BaseType> p(new DerivedType(4));
+    const auto allocations = allocation_count;
+    auto copied = p;
+    const auto allocated = allocation_count - allocations;
+
+    THEN("Copies take a single allocation") {
+      CHECK(allocated == 1);
+      CHECK(copied->value() == 4);
+    }
+  }
+
+  GIVEN("A value adopted with a copier that copies into storage") {
+    size_t copy_count = 0;
+    size_t deletion_count = 0;
+    polymorphic_value<BaseType> p(new DerivedType(5),
+                                  counting_copier{&copy_count},
+                                  [&](const DerivedType* d) {
+                                    ++deletion_count;
+                                    delete d;
+                                  });
+    {
+      const auto allocations = allocation_count;
+      auto copied = p;
+      auto copy_of_copy = copied;
+      const auto allocated = allocation_count - allocations;
+
+      THEN("Copies are made into their control block") {
+        CHECK(allocated == 2);
+        CHECK(copy_count == 2);
+        CHECK(copy_of_copy->value() == 5);
+        CHECK(DerivedType::object_count == 3);
+      }
+    }
+
+    THEN("Copies are destroyed without the deleter") {
+      CHECK(deletion_count == 0);
+      CHECK(DerivedType::object_count == 1);
+    }
+  }
+}
+
 TEST_CASE("polymorphic_value destructor", "[polymorphic_value.destructor]") {
   GIVEN("No derived objects") {
     REQUIRE(DerivedType::object_count == 0);
@@ -557,15 +656,48 @@ TEST_CASE("Derived types", "[polymorphic_value.derived_types]") {
     }
 
     WHEN("A polymorphic_value<BaseType> is move-constructed") {
+      const auto p = cptr.operator->();
+      const auto allocations = allocation_count;
       polymorphic_value<BaseType> bptr(std::move(cptr));
+      const auto allocated = allocation_count - allocations;
 
       THEN("Operator-> calls the pointee method") {
         REQUIRE(bptr->value() == v);
       }
 
       THEN("operator bool returns true") { REQUIRE((bool)bptr == true); }
+
+      THEN("The object is taken over without allocating") {
+        REQUIRE(allocated == 0);
+        REQUIRE(bptr.operator->() == p);
+        REQUIRE(!cptr);
+      }
+    }
+
+    WHEN("It is move-assigned to a polymorphic_value<BaseType>") {
+      polymorphic_value<BaseType> bptr(std::in_place_type<DerivedType>, 3);
+      const auto p = cptr.operator->();
+      const auto allocations = allocation_count;
+      bptr = std::move(cptr);
+      const auto allocated = allocation_count - allocations;
+
+      THEN("The object is taken over without allocating") {
+        REQUIRE(allocated == 0);
+        REQUIRE(bptr.operator->() == p);
+        REQUIRE(bptr->value() == v);
+        REQUIRE(!cptr);
+        REQUIRE(DerivedType::object_count == 1);
+      }
     }
   }
+
+  using derived_rvalue = polymorphic_value<DerivedType>&&;
+  static_assert(std::is_nothrow_constructible<polymorphic_value<BaseType>,
+                                              derived_rvalue>::value,
+                "");
+  static_assert(std::is_nothrow_assignable<polymorphic_value<BaseType>&,
+                                           derived_rvalue>::value,
+                "");
 }
 
 struct Base {
@@ -605,6 +737,38 @@ TEST_CASE("Gustafsson's dilemma: multiple (virtual) base classes",
       REQUIRE(cptr_IB->b_ == 101);
       REQUIRE(cptr_IB->v_ == 42);
     }
+
+    THEN(
+        "Copies of a polymorphic_value to a non-primary base refer to the "
+        "same base subobject of the copied object") {
+      auto cptr_IB = polymorphic_value<IntermediateBaseB>(std::move(cptr));
+      cptr_IB->b_ = 7;
+
+      size_t allocations = allocation_count;
+      auto copy = cptr_IB;
+      REQUIRE(allocation_count - allocations == 1);
+
+      REQUIRE(&*copy != &*cptr_IB);
+      REQUIRE(copy->b_ == 7);
+      REQUIRE(copy->v_ == 42);
+      REQUIRE(dynamic_cast<MultiplyDerived&>(*copy).value_ == v);
+    }
+
+    THEN(
+        "Values converted through several base types are copied with a "
+        "single allocation") {
+      auto cptr_IA = polymorphic_value<IntermediateBaseA>(std::move(cptr));
+      auto cptr_B = polymorphic_value<Base>(std::move(cptr_IA));
+      cptr_B->v_ = 5;
+
+      size_t allocations = allocation_count;
+      auto copy = cptr_B;
+      auto copy_of_copy = copy;
+      REQUIRE(allocation_count - allocations == 2);
+
+      REQUIRE(copy_of_copy->v_ == 5);
+      REQUIRE(dynamic_cast<MultiplyDerived&>(*copy_of_copy).value_ == v);
+    }
   }
 }
 
@@ -721,6 +885,87 @@ TEST_CASE("Exception safety: throw in copier",
   }
 }
 
+namespace {
+struct OtherDerivedType : BaseType {
+  int value_ = 0;
+
+  OtherDerivedType(int v) : value_(v) {}
+
+  int value() const override { return -value_; }
+
+  void set_value(int i) override { value_ = i; }
+};
+}  // namespace
+
+TEST_CASE("Assignment and emplace reuse storage",
+          "[polymorphic_value.assignment]") {
+  GIVEN("Two values of the same dynamic type") {
+    polymorphic_value<BaseType> a(std::in_place_type<DerivedType>, 1);
+    polymorphic_value<BaseType> b(std::in_place_type<DerivedType>, 2);
+    const auto p = a.operator->();
+
+    const auto allocations = allocation_count;
+    a = b;
+    const auto allocated = allocation_count - allocations;
+
+    THEN("The object is copy-assigned in place") {
+      CHECK(allocated == 0);
+      CHECK(a.operator->() == p);
+      CHECK(a->value() == 2);
+      CHECK(b->value() == 2);
+      CHECK(DerivedType::object_count == 2);
+    }
+  }
+
+  GIVEN("Two values of different dynamic types") {
+    polymorphic_value<BaseType> a(std::in_place_type<DerivedType>, 1);
+    polymorphic_value<BaseType> b(std::in_place_type<OtherDerivedType>, 2);
+
+    const auto allocations = allocation_count;
+    a = b;
+    const auto allocated = allocation_count - allocations;
+
+    THEN("The object is replaced by a copy") {
+      CHECK(allocated == 1);
+      CHECK(a->value() == -2);
+      CHECK(DerivedType::object_count == 0);
+    }
+  }
+
+  GIVEN("A value replaced with emplace") {
+    polymorphic_value<BaseType> a(std::in_place_type<DerivedType>, 1);
+
+    const auto allocations = allocation_count;
+    auto& d = a.emplace<DerivedType>(3);
+    auto& o = a.emplace<OtherDerivedType>(4);
+    const auto allocated = allocation_count - allocations;
+
+    THEN("Objects that fit are constructed in the existing storage") {
+      CHECK(allocated == 0);
+      CHECK(static_cast<void*>(&d) == static_cast<void*>(&o));
+      CHECK(&*a == &o);
+      CHECK(a->value() == -4);
+      CHECK(DerivedType::object_count == 0);
+    }
+  }
+
+  GIVEN("An empty value replaced with emplace") {
+    polymorphic_value<BaseType> a;
+    a.emplace<DerivedType>(5);
+
+    THEN("It owns the new object") { CHECK(a->value() == 5); }
+  }
+
+  GIVEN("A value replaced with emplace by an object whose constructor throws") {
+    polymorphic_value<ThrowsOnCopy> a(std::in_place_type<ThrowsOnCopy>, 1);
+    const ThrowsOnCopy source(2);
+
+    CHECK_THROWS_AS(a.emplace<ThrowsOnCopy>(source), std::runtime_error);
+
+    THEN("The value is empty") { CHECK(!a); }
+  }
+}
+
 TEST_CASE("polymorphic_value<const T>",
           "[polymorphic_value.compatible_types]") {
   polymorphic_value<const DerivedType> p(std::in_place_type<DerivedType>, 7);
@@ -855,11 +1100,11 @@ TEST_CASE("Copying object with allocator allocates") {
   {
     polymorphic_value<DerivedType> p(mem, std::allocator_arg_t{}, alloc);
     polymorphic_value<DerivedType> p2(p);
-    CHECK(allocs == 3);
+    CHECK(allocs == 2);
     CHECK(deallocs == 0);
   }
-  CHECK(allocs == 3);
-  CHECK(deallocs == 4);
+  CHECK(allocs == 2);
+  CHECK(deallocs == 3);
 }
 
 TEST_CASE("Allocator used to construct with allocate_polymorphic_value") {
@@ -872,9 +1117,1348 @@ TEST_CASE("Allocator used to construct with allocate_polymorphic_value") {
     unsigned const value = 99;
     polymorphic_value<DerivedType> p = allocate_polymorphic_value<DerivedType>(
         std::allocator_arg_t{}, alloc, value);
-    CHECK(allocs == 2);
+    CHECK(allocs == 1);
     CHECK(deallocs == 0);
   }
-  CHECK(allocs == 2);
-  CHECK(deallocs == 2);
+  CHECK(allocs == 1);
+  CHECK(deallocs == 1);
+}
+
+TEST_CASE("Values created with an arena_allocator",
+          "[polymorphic_value.monotonic_arena]") {
+  for (bool huge_pages : {false, true}) {
+    monotonic_arena arena(64 * 1024, huge_pages);
+    arena_allocator<DerivedType> alloc(arena);
+
+    const DerivedType* first = nullptr;
+    {
+      auto p = allocate_polymorphic_value<BaseType, DerivedType>(
+          std::allocator_arg_t{}, alloc, 7);
+      first = static_cast<const DerivedType*>(&*p);
+
+      std::vector<polymorphic_value<BaseType>> copies;
+      copies.reserve(100);
+      const auto allocations = allocation_count;
+      for (int i = 0; i < 100; ++i) {
+        copies.push_back(p);
+      }
+      const auto allocated = allocation_count - allocations;
+
+      CHECK(allocated == 0);
+      CHECK(copies.back()->value() == 7);
+    }
+
+    arena.reset();
+
+    const auto allocations = allocation_count;
+    auto p = allocate_polymorphic_value<BaseType, DerivedType>(
+        std::allocator_arg_t{}, alloc, 8);
+    const auto allocated = allocation_count - allocations;
+
+    CHECK(allocated == 0);
+    CHECK(&*p == first);
+    CHECK(p->value() == 8);
+  }
+}
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_PMR
+namespace {
+class counting_resource : public std::pmr::memory_resource {
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+    ++allocations;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void* p, std::size_t bytes,
+                     std::size_t alignment) override {
+    ++deallocations;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+
+  bool do_is_equal(const memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+ public:
+  size_t allocations = 0;
+  size_t deallocations = 0;
+};
+
+// Holds a nested value in the memory resource it is created with.
+struct CompositeType : BaseType {
+  using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+  polymorphic_value<BaseType> inner_;
+
+  CompositeType(std::allocator_arg_t, const allocator_type& a, int v)
+      : inner_(std::allocator_arg, a, std::in_place_type<DerivedType>, v) {}
+
+  CompositeType(std::allocator_arg_t, const allocator_type& a,
+                const CompositeType& c)
+      : inner_(std::allocator_arg, a, c.inner_) {}
+
+  int value() const override { return inner_->value(); }
+
+  void set_value(int i) override { inner_->set_value(i); }
+};
+}  // namespace
+
+TEST_CASE("polymorphic_value with std::pmr allocators",
+          "[polymorphic_value.pmr]") {
+  static_assert(
+      std::uses_allocator<polymorphic_value<BaseType>,
+                          std::pmr::polymorphic_allocator<int>>::value,
+      "");
+
+  counting_resource resource;
+  std::pmr::vector<polymorphic_value<BaseType>> values(&resource);
+  values.reserve(8);
+
+  GIVEN("Values inserted into a std::pmr::vector") {
+    values.push_back(make_polymorphic_value<BaseType, DerivedType>(7));
+    values.emplace_back(std::in_place_type<DerivedType>, 8);
+
+    THEN("Their objects come from the vector's memory resource") {
+      CHECK(values[0]->value() == 7);
+      CHECK(values[1]->value() == 8);
+      CHECK(values[0].get_allocator().resource() == &resource);
+      CHECK(values[1].get_allocator().resource() == &resource);
+    }
+
+    THEN("Copies and moves within the resource keep using it") {
+      const auto allocations = resource.allocations;
+      auto copied = values[0];
+      values.push_back(std::move(copied));
+      CHECK(resource.allocations - allocations == 1);
+      CHECK(values.back().get_allocator().resource() == &resource);
+    }
+  }
+
+  GIVEN("A pointer-adopted value moved into a std::pmr::vector") {
+    const auto allocations = resource.allocations;
+    values.push_back(polymorphic_value<BaseType>(new DerivedType(5)));
+
+    THEN("Its copy comes from the vector's memory resource") {
+      CHECK(values[0]->value() == 5);
+      CHECK(resource.allocations - allocations == 1);
+      CHECK(values[0].get_allocator().resource() == &resource);
+    }
+  }
+
+  GIVEN("A value with a nested allocator-aware member") {
+    values.emplace_back(std::in_place_type<CompositeType>, 3);
+    const auto allocations = resource.allocations;
+    values.push_back(values[0]);
+
+    THEN("The nested value is copied into the same resource") {
+      CHECK(values[1]->value() == 3);
+      CHECK(resource.allocations - allocations == 2);
+    }
+  }
+}
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_ALLOCATION_RESOURCE
+TEST_CASE("Default allocations use the allocation resource",
+          "[polymorphic_value.allocation_resource]") {
+  counting_resource resource;
+  auto* previous = set_allocation_resource(&resource);
+  CHECK(get_allocation_resource() == &resource);
+
+  {
+    const auto allocations = allocation_count;
+    auto p = make_polymorphic_value<BaseType, DerivedType>(3);
+    auto copied = p;
+    polymorphic_value<BaseType> adopted(new DerivedType(4));
+    auto adopted_copy = adopted;
+    const auto allocated = allocation_count - allocations;
+
+    CHECK(allocated == 1);
+    CHECK(resource.allocations == 4);
+    CHECK(copied->value() == 3);
+    CHECK(adopted_copy->value() == 4);
+  }
+  CHECK(resource.deallocations == 4);
+
+  set_allocation_resource(previous);
+}
+
+TEST_CASE("Storage is released to the resource it was allocated from",
+          "[polymorphic_value.allocation_resource]") {
+  counting_resource first;
+  counting_resource second;
+  auto* previous = set_allocation_resource(&first);
+
+  {
+    auto p = make_polymorphic_value<BaseType, DerivedType>(3);
+    compact_polymorphic_value<MultiplyDerived> cv(
+        std::in_place_type<MultiplyDerived>, 7);
+    compact_polymorphic_value<IntermediateBaseB> converted(cv);
+    CHECK(first.allocations == 4);
+
+    set_allocation_resource(&second);
+    auto copied = p;
+    CHECK(second.allocations == 1);
+    CHECK(p.get_allocator().resource() == &first);
+    CHECK(copied.get_allocator().resource() == &second);
+  }
+  set_allocation_resource(previous);
+
+  CHECK(first.deallocations == 4);
+  CHECK(second.deallocations == 1);
+}
+#endif
+#endif
+
+namespace {
+struct PooledType : BaseType {
+  int value_ = 0;
+
+  PooledType(int v) : value_(v) {}
+
+  int value() const override { return value_; }
+
+  void set_value(int i) override { value_ = i; }
+};
+}  // namespace
+
+namespace isocpp_p0201 {
+template <>
+struct uses_control_block_pool<PooledType> : std::true_type {};
+}  // namespace isocpp_p0201
+
+TEST_CASE("Control blocks recycled through control_block_pool",
+          "[polymorphic_value.control_block_pool]") {
+  control_block_pool::trim();
+
+  GIVEN("Blocks reserved up front") {
+    control_block_pool::reserve<PooledType>(2);
+
+    const auto allocations = allocation_count;
+    {
+      auto p = make_polymorphic_value<BaseType, PooledType>(7);
+      auto copied = p;
+      copied->set_value(8);
+    }
+    {
+      polymorphic_value<BaseType> p(std::in_place_type<PooledType>, 9);
+      auto copied = p.try_clone();
+    }
+    const auto allocated = allocation_count - allocations;
+
+    THEN("Creating and copying values reuses them") {
+      CHECK(allocated == 0);
+    }
+  }
+
+  GIVEN("Trimmed pools") {
+    { auto p = make_polymorphic_value<BaseType, PooledType>(7); }
+    control_block_pool::trim();
+
+    const auto allocations = allocation_count;
+    auto p = make_polymorphic_value<BaseType, PooledType>(7);
+    const auto allocated = allocation_count - allocations;
+
+    THEN("Blocks are allocated again") { CHECK(allocated == 1); }
+  }
+
+  GIVEN("Blocks freed on another thread") {
+    std::vector<polymorphic_value<BaseType>> values;
+    values.reserve(4);
+    for (int i = 0; i < 4; ++i) {
+      values.push_back(make_polymorphic_value<BaseType, PooledType>(i));
+    }
+    std::thread([&] { values.clear(); }).join();
+
+    const auto allocations = allocation_count;
+    for (int i = 0; i < 4; ++i) {
+      values.push_back(make_polymorphic_value<BaseType, PooledType>(i));
+    }
+    const auto allocated = allocation_count - allocations;
+
+    THEN("They are reused once that thread exits") { CHECK(allocated == 0); }
+  }
+
+  GIVEN("More reserved blocks than a thread caches") {
+    constexpr std::size_t max_cached = detail::thread_cache::max_cached;
+    constexpr std::size_t reserved = max_cached + 8;
+    control_block_pool::reserve<PooledType>(reserved);
+
+    std::size_t allocated_from_rest = 0;
+    std::size_t allocated_past_rest = 0;
+    std::thread([&] {
+      auto first = make_polymorphic_value<BaseType, PooledType>(0);
+      std::thread([&] {
+        std::vector<polymorphic_value<BaseType>> values;
+        values.reserve(reserved);
+        const auto allocations = allocation_count;
+        for (std::size_t i = 0; i < reserved - max_cached; ++i) {
+          values.push_back(make_polymorphic_value<BaseType, PooledType>(1));
+        }
+        allocated_from_rest = allocation_count - allocations;
+        values.push_back(make_polymorphic_value<BaseType, PooledType>(2));
+        allocated_past_rest = allocation_count - allocations;
+      }).join();
+    }).join();
+
+    THEN("A thread takes at most that many and leaves the rest shared") {
+      CHECK(allocated_from_rest == 0);
+      CHECK(allocated_past_rest == 1);
+    }
+    control_block_pool::trim();
+  }
+}
+
+TEST_CASE("Values created with a budget_allocator",
+          "[polymorphic_value.allocation_budget]") {
+  allocation_budget budget;
+  budget.reserve<DerivedType>(2);
+  budget_allocator<DerivedType> alloc(budget);
+
+  {
+    const auto allocations = allocation_count;
+    auto p = allocate_polymorphic_value<BaseType, DerivedType>(
+        std::allocator_arg_t{}, alloc, 7);
+    polymorphic_value<BaseType> copied(p);
+    const auto allocated = allocation_count - allocations;
+
+    CHECK(allocated == 0);
+    CHECK(copied->value() == 7);
+
+    auto counters = budget.counters<DerivedType>();
+    CHECK(counters.reserved == 2);
+    CHECK(counters.in_use == 2);
+    CHECK(counters.high_water == 2);
+    CHECK(counters.failures == 0);
+
+    CHECK_THROWS_AS(polymorphic_value<BaseType>{p},
+                    allocation_budget_exhausted);
+    CHECK(budget.counters<DerivedType>().failures == 1);
+  }
+
+  auto counters = budget.counters<DerivedType>();
+  CHECK(counters.in_use == 0);
+  CHECK(counters.high_water == 2);
+}
+
+TEST_CASE("Values adopted with a budget_allocator",
+          "[polymorphic_value.allocation_budget]") {
+  allocation_budget budget;
+  budget.reserve<DerivedType>(1, 2);
+  budget_allocator<DerivedType> alloc(budget);
+
+  auto adopt = [&](int v) {
+    DerivedType* d = alloc.allocate(1);
+    ::new (d) DerivedType(v);
+    return polymorphic_value<BaseType>(d, std::allocator_arg, alloc);
+  };
+
+  {
+    const auto allocations = allocation_count;
+    auto p = adopt(1);
+    auto q = adopt(2);
+    const auto allocated = allocation_count - allocations;
+
+    CHECK(allocated == 0);
+    CHECK(p->value() == 1);
+    CHECK(q->value() == 2);
+    CHECK(budget.counters<DerivedType>().in_use == 2);
+
+    CHECK_THROWS_AS(alloc.allocate(1), allocation_budget_exhausted);
+    CHECK(budget.counters<DerivedType>().failures == 1);
+  }
+
+  CHECK_THROWS_AS(alloc.allocate(2), std::bad_array_new_length);
+  CHECK(budget.counters<DerivedType>().in_use == 0);
+
+  {
+    auto p = allocate_polymorphic_value<BaseType, DerivedType>(
+        std::allocator_arg_t{}, alloc, 3);
+    CHECK(budget.counters<DerivedType>().in_use == 1);
+  }
+
+  auto counters = budget.counters<DerivedType>();
+  CHECK(counters.reserved == 1);
+  CHECK(counters.in_use == 0);
+  CHECK(counters.high_water == 2);
+}
+
+TEST_CASE("try_clone with an exhausted budget_allocator",
+          "[polymorphic_value.allocation_budget]") {
+  allocation_budget budget;
+  budget.reserve<DerivedType>(1, 1);
+  budget_allocator<DerivedType> alloc(budget);
+
+  GIVEN("A value created with the allocator") {
+    auto p = allocate_polymorphic_value<BaseType, DerivedType>(
+        std::allocator_arg_t{}, alloc, 7);
+
+    THEN("try_clone returns an empty value") {
+      auto copied = p.try_clone();
+      CHECK(!copied);
+      CHECK(budget.counters<DerivedType>().failures == 1);
+    }
+  }
+
+  GIVEN("A value adopted with the allocator") {
+    auto p = allocate_polymorphic_value<BaseType, DerivedType>(
+        std::allocator_arg_t{}, alloc, 7);
+    DerivedType* d = alloc.allocate(1);
+    ::new (d) DerivedType(8);
+    polymorphic_value<BaseType> adopted(d, std::allocator_arg, alloc);
+
+    THEN("try_clone returns an empty value") {
+      auto copied = adopted.try_clone();
+      CHECK(!copied);
+      CHECK(budget.counters<DerivedType>().failures == 1);
+    }
+  }
+}
+
+namespace {
+template <typename T>
+bool is_stored_inline(const T& t, const void* p) {
+  auto begin = reinterpret_cast<const char*>(std::addressof(t));
+  auto q = static_cast<const char*>(p);
+  return q >= begin && q < begin + sizeof(T);
+}
+
+struct NothrowDerivedType : BaseType {
+  int value_ = 0;
+
+  NothrowDerivedType(int v) noexcept : value_(v) { ++object_count; }
+
+  NothrowDerivedType(const NothrowDerivedType& d) noexcept : value_(d.value_) {
+    ++object_count;
+  }
+
+  ~NothrowDerivedType() { --object_count; }
+
+  int value() const override { return value_; }
+
+  void set_value(int i) override { value_ = i; }
+
+  static size_t object_count;
+};
+
+size_t NothrowDerivedType::object_count = 0;
+
+struct LargeDerivedType : NothrowDerivedType {
+  char payload_[256] = {};
+
+  using NothrowDerivedType::NothrowDerivedType;
+};
+}  // namespace
+
+namespace {
+struct BufferType : BaseType {
+  std::vector<char> buffer_;
+  polymorphic_value<BaseType> next_;
+
+  BufferType(std::size_t size, polymorphic_value<BaseType> next = {})
+      : buffer_(size), next_(std::move(next)) {}
+
+  int value() const override { return int(buffer_.size()); }
+
+  void set_value(int) override {}
+
+  std::size_t dynamic_memory_footprint() const {
+    return buffer_.capacity() + next_.memory_footprint(true).total();
+  }
+};
+}  // namespace
+
+TEST_CASE("Memory footprint of polymorphic_value",
+          "[polymorphic_value.memory_footprint]") {
+  GIVEN("An empty value") {
+    polymorphic_value<BaseType> p;
+
+    THEN("It owns no memory") { CHECK(p.memory_footprint().total() == 0); }
+  }
+
+  GIVEN("A value created in place") {
+    auto p = make_polymorphic_value<BaseType, DerivedType>(1);
+    auto f = p.memory_footprint();
+
+    THEN("The object and control block share one allocation") {
+      CHECK(f.object_size == sizeof(DerivedType));
+      CHECK(f.object_alignment == alignof(DerivedType));
+      CHECK(f.control_block_size > 0);
+      CHECK(f.allocated == f.object_size + f.control_block_size);
+      CHECK(f.nested == 0);
+    }
+  }
+
+  GIVEN("A value adopted from a pointer") {
+    polymorphic_value<BaseType> p(new DerivedType(1));
+    auto f = p.memory_footprint();
+
+    THEN("The object and control block are allocated separately") {
+      CHECK(f.object_size == sizeof(DerivedType));
+      CHECK(f.allocated == f.object_size + f.control_block_size);
+      CHECK(f.control_block_size > sizeof(void*));
+    }
+  }
+
+  GIVEN("A value whose control block is pooled") {
+    auto p = make_polymorphic_value<BaseType, PooledType>(1);
+    auto f = p.memory_footprint();
+
+    THEN("The allocation is rounded up to the pool size class") {
+      CHECK(f.allocated % 16 == 0);
+      CHECK(f.allocated >= f.object_size + f.control_block_size);
+    }
+  }
+
+  GIVEN("Nested values whose objects report their own memory") {
+    auto inner = make_polymorphic_value<BaseType, BufferType>(100);
+    auto p = make_polymorphic_value<BaseType, BufferType>(1000, inner);
+    auto f = p.memory_footprint();
+    auto recursive = p.memory_footprint(true);
+
+    THEN("Recursive mode includes the memory they report") {
+      CHECK(f.nested == 0);
+      CHECK(recursive.allocated == f.allocated);
+      CHECK(recursive.nested ==
+            1000 + 100 + inner.memory_footprint().allocated);
+    }
+  }
+}
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_LARGE_OBJECTS
+namespace {
+struct LargeType : BaseType {
+  static constexpr std::size_t size = std::size_t(4) << 20;
+
+  unsigned char data_[size];
+
+  explicit LargeType(int v) { set_value(v); }
+
+  int value() const override { return data_[0] + data_[size - 1]; }
+
+  void set_value(int v) override {
+    data_[0] = static_cast<unsigned char>(v);
+    data_[size - 1] = static_cast<unsigned char>(v);
+  }
+};
+}  // namespace
+
+namespace isocpp_p0201 {
+template <>
+struct uses_large_object_storage<LargeType> : std::true_type {};
+}  // namespace isocpp_p0201
+
+TEST_CASE("Large objects are copied copy-on-write",
+          "[polymorphic_value.large_object]") {
+  auto p = make_polymorphic_value<BaseType, LargeType>(1);
+  CHECK(p->value() == 2);
+
+  GIVEN("Copies of a large object") {
+    const auto allocations = allocation_count;
+    auto copied = p;
+    auto copy_of_copy = copied;
+    const auto allocated = allocation_count - allocations;
+
+    THEN("They are mapped without allocating") {
+      CHECK(allocated == 0);
+      CHECK(&*copied != &*p);
+      CHECK(copied->value() == 2);
+      CHECK(copy_of_copy->value() == 2);
+    }
+
+    THEN("Writes to one are not seen by the others") {
+      p->set_value(3);
+      copied->set_value(4);
+      CHECK(p->value() == 6);
+      CHECK(copied->value() == 8);
+      CHECK(copy_of_copy->value() == 2);
+    }
+
+    THEN("Copies made after writes see them") {
+      copied->set_value(5);
+      auto later = copied;
+      p->set_value(6);
+      auto later_of_original = p;
+      CHECK(later->value() == 10);
+      CHECK(later_of_original->value() == 12);
+      CHECK(copy_of_copy->value() == 2);
+    }
+  }
+
+  GIVEN("The footprint of a large object") {
+    const auto f = p.memory_footprint();
+    const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+
+    THEN("Whole pages of its mapping are reported") {
+      CHECK(f.object_size == sizeof(LargeType));
+      CHECK(f.allocated >= sizeof(LargeType));
+      CHECK(f.allocated % page == 0);
+    }
+  }
+
+  GIVEN("A large object written and copied in a forked process") {
+    const ::pid_t pid = ::fork();
+    if (pid == 0) {
+      p->set_value(9);
+      auto copied = p;
+      ::_exit(copied->value() == 18 ? 0 : 1);
+    }
+    int status = -1;
+    ::waitpid(pid, &status, 0);
+    auto copied = p;
+
+    THEN("Neither process sees the other's writes") {
+      CHECK(WIFEXITED(status));
+      CHECK(WEXITSTATUS(status) == 0);
+      CHECK(p->value() == 2);
+      CHECK(copied->value() == 2);
+    }
+  }
+
+  GIVEN("A large object replaced with emplace") {
+    p.emplace<LargeType>(7);
+
+    THEN("The value owns the new object") { CHECK(p->value() == 14); }
+  }
+}
+#endif
+
+TEST_CASE("small_polymorphic_value stores small objects inline",
+          "[small_polymorphic_value.constructors]") {
+  GIVEN("An in-place-constructed small_polymorphic_value to a small type") {
+    small_polymorphic_value<BaseType> sv(
+        std::in_place_type<NothrowDerivedType>, 7);
+
+    THEN("The object is stored inside the handle") {
+      REQUIRE(is_stored_inline(sv, sv.operator->()));
+      REQUIRE(sv->value() == 7);
+      REQUIRE(NothrowDerivedType::object_count == 1);
+    }
+  }
+
+  GIVEN(
+      "An in-place-constructed small_polymorphic_value to a type that is not "
+      "nothrow-move-constructible") {
+    small_polymorphic_value<BaseType> sv(std::in_place_type<DerivedType>, 7);
+
+    THEN("The object is heap-allocated") {
+      REQUIRE_FALSE(is_stored_inline(sv, sv.operator->()));
+      REQUIRE(sv->value() == 7);
+    }
+  }
+
+  GIVEN("An in-place-constructed small_polymorphic_value to a large type") {
+    small_polymorphic_value<BaseType> sv(std::in_place_type<LargeDerivedType>,
+                                         7);
+
+    THEN("The object is heap-allocated") {
+      REQUIRE_FALSE(is_stored_inline(sv, sv.operator->()));
+      REQUIRE(sv->value() == 7);
+      REQUIRE(NothrowDerivedType::object_count == 1);
+    }
+  }
+  REQUIRE(NothrowDerivedType::object_count == 0);
+}
+
+TEST_CASE("small_polymorphic_value copy and move",
+          "[small_polymorphic_value.constructors]") {
+  GIVEN("A small_polymorphic_value to a small type") {
+    small_polymorphic_value<BaseType> sv(
+        std::in_place_type<NothrowDerivedType>, 7);
+
+    WHEN("It is copied") {
+      auto copy = sv;
+      copy->set_value(42);
+
+      THEN("The copy is distinct and stored inline") {
+        REQUIRE(is_stored_inline(copy, copy.operator->()));
+        REQUIRE(copy->value() == 42);
+        REQUIRE(sv->value() == 7);
+        REQUIRE(NothrowDerivedType::object_count == 2);
+      }
+    }
+
+    WHEN("It is moved") {
+      auto moved = std::move(sv);
+
+      THEN("The object is relocated and the source is empty") {
+        REQUIRE(is_stored_inline(moved, moved.operator->()));
+        REQUIRE(moved->value() == 7);
+        REQUIRE_FALSE(sv);
+        REQUIRE(NothrowDerivedType::object_count == 1);
+      }
+    }
+  }
+
+  GIVEN("A small_polymorphic_value to a large type") {
+    small_polymorphic_value<BaseType> sv(std::in_place_type<LargeDerivedType>,
+                                         7);
+    auto p = sv.operator->();
+
+    WHEN("It is moved") {
+      auto moved = std::move(sv);
+
+      THEN("The heap-allocated object is transferred") {
+        REQUIRE(moved.operator->() == p);
+        REQUIRE_FALSE(sv);
+        REQUIRE(NothrowDerivedType::object_count == 1);
+      }
+    }
+
+    WHEN("It is copied") {
+      auto copy = sv;
+
+      THEN("The copy is distinct") {
+        REQUIRE(copy.operator->() != p);
+        REQUIRE(copy->value() == 7);
+        REQUIRE(NothrowDerivedType::object_count == 2);
+      }
+    }
+  }
+  REQUIRE(NothrowDerivedType::object_count == 0);
+}
+
+TEST_CASE("small_polymorphic_value assignment and swap",
+          "[small_polymorphic_value.assignment]") {
+  small_polymorphic_value<BaseType> small(
+      std::in_place_type<NothrowDerivedType>, 7);
+  small_polymorphic_value<BaseType> large(std::in_place_type<LargeDerivedType>,
+                                          42);
+
+  small.swap(large);
+  REQUIRE(small->value() == 42);
+  REQUIRE(large->value() == 7);
+  REQUIRE(is_stored_inline(large, large.operator->()));
+  REQUIRE_FALSE(is_stored_inline(small, small.operator->()));
+
+  small = large;
+  REQUIRE(small->value() == 7);
+  REQUIRE(is_stored_inline(small, small.operator->()));
+  REQUIRE(NothrowDerivedType::object_count == 2);
+
+  large = small_polymorphic_value<BaseType>();
+  REQUIRE_FALSE(large);
+  REQUIRE(NothrowDerivedType::object_count == 1);
+}
+
+TEST_CASE("small_polymorphic_value converting constructors",
+          "[small_polymorphic_value.constructors]") {
+  small_polymorphic_value<NothrowDerivedType> derived(
+      std::in_place_type<NothrowDerivedType>, 7);
+
+  small_polymorphic_value<BaseType> copied(derived);
+  REQUIRE(copied->value() == 7);
+  REQUIRE(derived->value() == 7);
+  REQUIRE(NothrowDerivedType::object_count == 2);
+
+  small_polymorphic_value<BaseType> moved(std::move(derived));
+  REQUIRE(moved->value() == 7);
+  REQUIRE_FALSE(derived);
+  REQUIRE(NothrowDerivedType::object_count == 2);
+}
+
+TEST_CASE("small_polymorphic_value pointer constructor",
+          "[small_polymorphic_value.constructors]") {
+  small_polymorphic_value<BaseType> sv(new DerivedType(7));
+  auto copy = sv;
+  REQUIRE(copy->value() == 7);
+  REQUIRE(copy.operator->() != sv.operator->());
+  REQUIRE(DerivedType::object_count == 2);
+}
+
+TEST_CASE("small_polymorphic_value exception safety",
+          "[small_polymorphic_value.exception_safety]") {
+  const int v = 7;
+  small_polymorphic_value<ThrowsOnCopy> sv(std::in_place_type<ThrowsOnCopy>,
+                                           v);
+  const int v2 = 5;
+  small_polymorphic_value<ThrowsOnCopy> another(
+      std::in_place_type<ThrowsOnCopy>, v2);
+  Tracked::reset_counts();
+  REQUIRE_THROWS_AS(another = sv, std::runtime_error);
+  REQUIRE(another->value_ == v2);
+  REQUIRE(sv->value_ == v);
+  REQUIRE(Tracked::ctor_count_ - Tracked::dtor_count_ == 0);
+}
+
+TEST_CASE("inplace_polymorphic_value never allocates",
+          "[inplace_polymorphic_value.constructors]") {
+  using value = inplace_polymorphic_value<BaseType, sizeof(LargeDerivedType)>;
+  const auto allocations = allocation_count;
+
+  value small(std::in_place_type<NothrowDerivedType>, 7);
+  value large(std::in_place_type<LargeDerivedType>, 42);
+  REQUIRE(is_stored_inline(small, small.operator->()));
+  REQUIRE(is_stored_inline(large, large.operator->()));
+
+  value copy(small);
+  value moved(std::move(large));
+  copy = moved;
+  copy.swap(small);
+  moved = std::move(small);
+
+  REQUIRE(allocation_count == allocations);
+  REQUIRE(copy->value() == 7);
+  REQUIRE(moved->value() == 42);
+  REQUIRE_FALSE(small);
+  REQUIRE_FALSE(large);
+  REQUIRE(NothrowDerivedType::object_count == 2);
+}
+
+TEST_CASE("inplace_polymorphic_value in arrays",
+          "[inplace_polymorphic_value.constructors]") {
+  using value = inplace_polymorphic_value<BaseType, sizeof(NothrowDerivedType)>;
+  value values[4];
+  for (int i = 0; i < 4; ++i) {
+    values[i] = value(std::in_place_type<NothrowDerivedType>, i);
+  }
+  std::swap(values[0], values[3]);
+  REQUIRE(values[0]->value() == 3);
+  REQUIRE(values[3]->value() == 0);
+  REQUIRE(NothrowDerivedType::object_count == 4);
+}
+
+struct ThrowsOnCopyNothrowMove : ThrowsOnCopy {
+  using ThrowsOnCopy::ThrowsOnCopy;
+
+  ThrowsOnCopyNothrowMove(const ThrowsOnCopyNothrowMove&) = default;
+
+  ThrowsOnCopyNothrowMove(ThrowsOnCopyNothrowMove&& t) noexcept
+      : ThrowsOnCopy(t.value_) {}
+};
+
+TEST_CASE("inplace_polymorphic_value exception safety",
+          "[inplace_polymorphic_value.exception_safety]") {
+  using value = inplace_polymorphic_value<ThrowsOnCopy,
+                                          sizeof(ThrowsOnCopyNothrowMove)>;
+  const int v = 7;
+  value iv(std::in_place_type<ThrowsOnCopyNothrowMove>, v);
+  const int v2 = 5;
+  value another(std::in_place_type<ThrowsOnCopyNothrowMove>, v2);
+  Tracked::reset_counts();
+  REQUIRE_THROWS_AS(another = iv, std::runtime_error);
+  REQUIRE(another->value_ == v2);
+  REQUIRE(iv->value_ == v);
+  REQUIRE(Tracked::ctor_count_ - Tracked::dtor_count_ == 0);
+}
+
+TEST_CASE("polymorphic_value clone into caller-provided storage",
+          "[polymorphic_value.clone_into]") {
+  GIVEN("An empty polymorphic_value") {
+    polymorphic_value<BaseType> p;
+
+    THEN("No storage is required and the clone is empty") {
+      REQUIRE(p.clone_size() == 0);
+      REQUIRE(p.clone_into(nullptr) == nullptr);
+    }
+  }
+
+  GIVEN("An in-place-constructed polymorphic_value") {
+    polymorphic_value<BaseType> p(std::in_place_type<DerivedType>, 7);
+    alignas(std::max_align_t) unsigned char storage[64];
+    REQUIRE(p.clone_size() <= sizeof(storage));
+    REQUIRE(p.clone_alignment() <= alignof(std::max_align_t));
+
+    WHEN("It is cloned into storage") {
+      const auto allocations = allocation_count;
+      auto clone = p.clone_into(storage);
+      const auto clone_allocations = allocation_count - allocations;
+
+      THEN("The clone lives in the storage and does not allocate") {
+        REQUIRE(clone_allocations == 0);
+        REQUIRE(is_stored_inline(storage, clone.get()));
+        REQUIRE(clone->value() == 7);
+        REQUIRE(DerivedType::object_count == 2);
+      }
+
+      THEN("The clone is distinct") {
+        clone->set_value(42);
+        REQUIRE(p->value() == 7);
+      }
+
+      THEN("Resetting the clone destroys the object") {
+        clone.reset();
+        REQUIRE(DerivedType::object_count == 1);
+      }
+    }
+  }
+
+  GIVEN("A pointer-constructed polymorphic_value") {
+    polymorphic_value<BaseType> p(new DerivedType(7));
+    alignas(std::max_align_t) unsigned char storage[64];
+    REQUIRE(p.clone_size() <= sizeof(storage));
+
+    THEN("The clone copies the object") {
+      auto clone = p.clone_into(storage);
+      REQUIRE(clone->value() == 7);
+      REQUIRE(clone.get() != p.operator->());
+      REQUIRE(DerivedType::object_count == 2);
+    }
+  }
+  REQUIRE(DerivedType::object_count == 0);
+}
+
+TEST_CASE("compact_polymorphic_value is a single pointer",
+          "[compact_polymorphic_value.class]") {
+  REQUIRE(sizeof(compact_polymorphic_value<BaseType>) == sizeof(void*));
+  REQUIRE(sizeof(compact_polymorphic_value<Base>) == sizeof(void*));
+}
+
+TEST_CASE("compact_polymorphic_value copy and move",
+          "[compact_polymorphic_value.constructors]") {
+  GIVEN("An empty compact_polymorphic_value") {
+    compact_polymorphic_value<BaseType> cv;
+
+    THEN("Copies and moves are empty") {
+      REQUIRE_FALSE(cv);
+      auto copied = cv;
+      REQUIRE_FALSE(copied);
+      auto moved = std::move(cv);
+      REQUIRE_FALSE(moved);
+    }
+  }
+
+  GIVEN("An in-place-constructed compact_polymorphic_value") {
+    compact_polymorphic_value<BaseType> cv(std::in_place_type<DerivedType>, 7);
+    REQUIRE(cv->value() == 7);
+
+    THEN("Copying allocates a single control block and copies the object") {
+      const auto allocations = allocation_count;
+      auto copied = cv;
+      REQUIRE(allocation_count - allocations == 1);
+      REQUIRE(copied->value() == 7);
+      REQUIRE(&*copied != &*cv);
+      REQUIRE(DerivedType::object_count == 2);
+    }
+
+    THEN("Moving transfers ownership") {
+      const auto* p = &*cv;
+      auto moved = std::move(cv);
+      REQUIRE_FALSE(cv);
+      REQUIRE(&*moved == p);
+      REQUIRE(DerivedType::object_count == 1);
+    }
+
+    THEN("Assignment copies and replaces the object") {
+      compact_polymorphic_value<BaseType> other(new DerivedType(3));
+      other = cv;
+      REQUIRE(other->value() == 7);
+      REQUIRE(DerivedType::object_count == 2);
+
+      other = compact_polymorphic_value<BaseType>();
+      REQUIRE_FALSE(other);
+      REQUIRE(DerivedType::object_count == 1);
+    }
+  }
+
+  GIVEN("A pointer-constructed compact_polymorphic_value") {
+    compact_polymorphic_value<BaseType> cv(new DerivedType(7));
+
+    THEN("Copies are distinct") {
+      auto copied = cv;
+      copied->set_value(42);
+      REQUIRE(cv->value() == 7);
+      REQUIRE(copied->value() == 42);
+    }
+  }
+  REQUIRE(DerivedType::object_count == 0);
+}
+
+TEST_CASE("compact_polymorphic_value conversion to a non-primary base",
+          "[compact_polymorphic_value.constructors]") {
+  compact_polymorphic_value<MultiplyDerived> cv(
+      std::in_place_type<MultiplyDerived>, 7);
+
+  compact_polymorphic_value<IntermediateBaseB> converted(cv);
+  REQUIRE(converted->b_ == 101);
+  REQUIRE(converted->v_ == 42);
+
+  auto copied = converted;
+  copied->b_ = 3;
+  REQUIRE(converted->b_ == 101);
+  REQUIRE(dynamic_cast<MultiplyDerived&>(*copied).value_ == 7);
+
+  compact_polymorphic_value<Base> base(std::move(copied));
+  REQUIRE_FALSE(copied);
+  REQUIRE(base->v_ == 42);
+  REQUIRE(dynamic_cast<MultiplyDerived&>(*base).b_ == 3);
+}
+
+namespace {
+struct TaggedA : DerivedType {
+  using DerivedType::DerivedType;
+};
+
+struct TaggedB : DerivedType {
+  using DerivedType::DerivedType;
+};
+}  // namespace
+
+namespace isocpp_p0201 {
+template <>
+struct type_tag<TaggedA> : std::integral_constant<std::size_t, 1> {};
+
+template <>
+struct type_tag<TaggedB> : std::integral_constant<std::size_t, 2> {};
+}  // namespace isocpp_p0201
+
+TEST_CASE("polymorphic_value type tags", "[polymorphic_value.type_tag]") {
+  static_assert(max_type_tag >= 4, "");
+  static_assert(sizeof(polymorphic_value<BaseType>) == 2 * sizeof(void*), "");
+
+  GIVEN("Empty and untagged polymorphic_values") {
+    polymorphic_value<BaseType> empty;
+    polymorphic_value<BaseType> untagged(std::in_place_type<DerivedType>, 7);
+
+    THEN("The type tag is zero") {
+      REQUIRE(empty.type_tag() == 0);
+      REQUIRE(untagged.type_tag() == 0);
+    }
+  }
+
+  GIVEN("polymorphic_values owning tagged types") {
+    polymorphic_value<BaseType> a(std::in_place_type<TaggedA>, 1);
+    polymorphic_value<BaseType> b(new TaggedB(2));
+
+    THEN("The type tag identifies the owned type") {
+      REQUIRE(a.type_tag() == type_tag_v<TaggedA>);
+      REQUIRE(b.type_tag() == type_tag_v<TaggedB>);
+      REQUIRE(a->value() == 1);
+      REQUIRE(b->value() == 2);
+    }
+
+    THEN("Copies, moves and conversions keep the type tag") {
+      auto copied = a;
+      REQUIRE(copied.type_tag() == type_tag_v<TaggedA>);
+
+      polymorphic_value<DerivedType> derived(std::in_place_type<TaggedB>, 3);
+      polymorphic_value<BaseType> converted(std::move(derived));
+      REQUIRE(converted.type_tag() == type_tag_v<TaggedB>);
+      REQUIRE(converted->value() == 3);
+
+      swap(a, b);
+      REQUIRE(a.type_tag() == type_tag_v<TaggedB>);
+      REQUIRE(b.type_tag() == type_tag_v<TaggedA>);
+    }
+  }
+}
+
+namespace {
+struct ClonableBase : BaseType {
+  virtual ClonableBase* clone() const = 0;
+};
+
+struct ClonableDerived : ClonableBase {
+  int value_ = 0;
+
+  ClonableDerived(int v) : value_(v) { ++object_count; }
+
+  ClonableDerived(const ClonableDerived& d) : value_(d.value_) {
+    ++object_count;
+  }
+
+  ~ClonableDerived() { --object_count; }
+
+  ClonableBase* clone() const override {
+    ++clone_count;
+    return new ClonableDerived(*this);
+  }
+
+  int value() const override { return value_; }
+
+  void set_value(int i) override { value_ = i; }
+
+  static size_t object_count;
+  static size_t clone_count;
+};
+
+size_t ClonableDerived::object_count = 0;
+size_t ClonableDerived::clone_count = 0;
+}  // namespace
+
+namespace isocpp_p0201 {
+template <>
+struct is_intrusively_clonable<ClonableBase> : std::true_type {};
+}  // namespace isocpp_p0201
+
+TEST_CASE("polymorphic_value of intrusively clonable types",
+          "[polymorphic_value.intrusive]") {
+  ClonableDerived::clone_count = 0;
+
+  GIVEN("An in-place-constructed polymorphic_value") {
+    const auto allocations = allocation_count;
+    polymorphic_value<ClonableBase> p(std::in_place_type<ClonableDerived>, 7);
+    const auto construction_allocations = allocation_count - allocations;
+
+    THEN("Only the object is allocated") {
+      REQUIRE(construction_allocations == 1);
+      REQUIRE(p);
+      REQUIRE(p->value() == 7);
+      REQUIRE(ClonableDerived::object_count == 1);
+    }
+
+    THEN("Copies use clone and allocate only the object") {
+      const auto copy_allocations = allocation_count;
+      auto copied = p;
+      REQUIRE(allocation_count - copy_allocations == 1);
+      REQUIRE(ClonableDerived::clone_count == 1);
+      REQUIRE(&*copied != &*p);
+      REQUIRE(copied->value() == 7);
+      REQUIRE(ClonableDerived::object_count == 2);
+    }
+
+    THEN("Assignment replaces the object") {
+      polymorphic_value<ClonableBase> other(new ClonableDerived(3));
+      other = p;
+      REQUIRE(other->value() == 7);
+      REQUIRE(ClonableDerived::object_count == 2);
+
+      other = polymorphic_value<ClonableBase>();
+      REQUIRE_FALSE(other);
+      REQUIRE(ClonableDerived::object_count == 1);
+    }
+
+    THEN("Moves transfer ownership") {
+      auto moved = std::move(p);
+      REQUIRE_FALSE(p);
+      REQUIRE(moved->value() == 7);
+      REQUIRE(ClonableDerived::object_count == 1);
+    }
+
+    THEN("Converting to a base that is not intrusively clonable keeps value "
+         "semantics") {
+      polymorphic_value<BaseType> converted(p);
+      REQUIRE(ClonableDerived::object_count == 2);
+
+      auto copied = converted;
+      copied->set_value(42);
+      REQUIRE(converted->value() == 7);
+      REQUIRE(copied->value() == 42);
+      REQUIRE(ClonableDerived::object_count == 3);
+    }
+  }
+
+  GIVEN("A polymorphic_value converted from a derived type") {
+    polymorphic_value<ClonableBase> p(
+        make_polymorphic_value<ClonableDerived>(7));
+
+    THEN("Copies use the control block of the derived type") {
+      auto copied = p;
+      REQUIRE(ClonableDerived::clone_count == 0);
+      REQUIRE(copied->value() == 7);
+      REQUIRE(ClonableDerived::object_count == 2);
+    }
+  }
+  REQUIRE(ClonableDerived::object_count == 0);
+}
+
+namespace {
+struct Message {
+  int kind = 0;
+};
+
+struct Payload : Message {
+  int data[8] = {};
+
+  explicit Payload(int v) {
+    kind = 1;
+    data[7] = v;
+  }
+};
+}  // namespace
+
+TEST_CASE("polymorphic_value of trivially copyable types",
+          "[polymorphic_value.trivially_copyable]") {
+  static_assert(
+      std::is_trivially_copyable_v<detail::direct_control_block<Payload>>, "");
+
+  polymorphic_value<Message> p(std::in_place_type<Payload>, 7);
+
+  THEN("Copies are distinct and allocate a single control block") {
+    const auto allocations = allocation_count;
+    auto copied = p;
+    REQUIRE(allocation_count - allocations == 1);
+    REQUIRE(&*copied != &*p);
+    REQUIRE(copied->kind == 1);
+    REQUIRE(static_cast<Payload&>(*copied).data[7] == 7);
+
+    static_cast<Payload&>(*copied).data[7] = 42;
+    REQUIRE(static_cast<Payload&>(*p).data[7] == 7);
+  }
+
+  THEN("Copies into caller-provided storage do not allocate") {
+    alignas(std::max_align_t) unsigned char storage[64];
+    REQUIRE(p.clone_size() <= sizeof(storage));
+    const auto allocations = allocation_count;
+    auto clone = p.clone_into(storage);
+    REQUIRE(allocation_count - allocations == 0);
+    REQUIRE(is_stored_inline(storage, clone.get()));
+    REQUIRE(static_cast<Payload&>(*clone).data[7] == 7);
+  }
+
+  THEN("Copies of small_polymorphic_value stay inline") {
+    small_polymorphic_value<Message, sizeof(Payload)> small(
+        std::in_place_type<Payload>, 7);
+    auto copied = small;
+    REQUIRE(is_stored_inline(copied, &*copied));
+    REQUIRE(static_cast<Payload&>(*copied).data[7] == 7);
+  }
+}
+
+TEST_CASE("Relocation of polymorphic_values",
+          "[polymorphic_value.relocation]") {
+  static_assert(is_trivially_relocatable_v<polymorphic_value<BaseType>>, "");
+  static_assert(is_trivially_relocatable_v<compact_polymorphic_value<BaseType>>,
+                "");
+  static_assert(!is_trivially_relocatable_v<small_polymorphic_value<BaseType>>,
+                "");
+
+  GIVEN("polymorphic_values in uninitialized storage") {
+    constexpr std::size_t n = 4;
+    alignas(polymorphic_value<BaseType>) unsigned char
+        from_storage[n * sizeof(polymorphic_value<BaseType>)];
+    alignas(polymorphic_value<BaseType>) unsigned char
+        to_storage[n * sizeof(polymorphic_value<BaseType>)];
+    auto* from = reinterpret_cast<polymorphic_value<BaseType>*>(from_storage);
+    auto* to = reinterpret_cast<polymorphic_value<BaseType>*>(to_storage);
+    for (std::size_t i = 0; i != n; ++i) {
+      ::new (static_cast<void*>(from + i))
+          polymorphic_value<BaseType>(std::in_place_type<DerivedType>, int(i));
+    }
+
+    THEN("Relocation transfers the objects without copying them") {
+      const auto* object = &*from[2];
+      REQUIRE(uninitialized_relocate(from, from + n, to) == to + n);
+      REQUIRE(DerivedType::object_count == n);
+      REQUIRE(&*to[2] == object);
+      for (std::size_t i = 0; i != n; ++i) {
+        REQUIRE(to[i]->value() == int(i));
+        to[i].~polymorphic_value();
+      }
+      REQUIRE(DerivedType::object_count == 0);
+    }
+  }
+
+  GIVEN("A vector of polymorphic_values") {
+    std::vector<polymorphic_value<BaseType>> values;
+    for (int v : {3, 1, 4, 1, 5, 9, 2, 6}) {
+      values.emplace_back(std::in_place_type<DerivedType>, v);
+    }
+
+    THEN("relocating_sort orders the values") {
+      relocating_sort(values.data(), values.data() + values.size(),
+                      [](const auto& a, const auto& b) {
+                        return a->value() < b->value();
+                      });
+      std::vector<int> sorted;
+      for (const auto& v : values) {
+        sorted.push_back(v->value());
+      }
+      REQUIRE(sorted == std::vector<int>{1, 1, 2, 3, 4, 5, 6, 9});
+      REQUIRE(DerivedType::object_count == values.size());
+    }
+  }
+  REQUIRE(DerivedType::object_count == 0);
+}
+
+TEST_CASE("Non-throwing construction and clone",
+          "[polymorphic_value.try_make_polymorphic_value]") {
+  GIVEN("Memory can be allocated") {
+    auto p = try_make_polymorphic_value<BaseType, DerivedType>(7);
+    REQUIRE(p);
+    REQUIRE(p->value() == 7);
+
+    auto copied = p.try_clone();
+    REQUIRE(copied);
+    REQUIRE(&*copied != &*p);
+    REQUIRE(copied->value() == 7);
+  }
+
+  GIVEN("Memory cannot be allocated") {
+    auto p = make_polymorphic_value<BaseType, DerivedType>(7);
+    const auto objects = DerivedType::object_count;
+
+    fail_allocations = true;
+    auto made = try_make_polymorphic_value<BaseType, DerivedType>(7);
+    auto made_intrusive =
+        try_make_polymorphic_value<ClonableBase, ClonableDerived>(7);
+    auto copied = p.try_clone();
+    fail_allocations = false;
+
+    REQUIRE(!made);
+    REQUIRE(!made_intrusive);
+    REQUIRE(!copied);
+    REQUIRE(DerivedType::object_count == objects);
+  }
+
+  GIVEN("A value adopted from a pointer") {
+    polymorphic_value<BaseType> p(new DerivedType(7));
+    const auto objects = DerivedType::object_count;
+
+    THEN("A copy is made in one allocation") {
+      const auto allocations = allocation_count;
+      auto copied = p.try_clone();
+      const auto allocated = allocation_count - allocations;
+      REQUIRE(copied);
+      REQUIRE(copied->value() == 7);
+      REQUIRE(allocated == 1);
+    }
+
+    THEN("Allocation failure yields an empty value") {
+      fail_allocations = true;
+      auto copied = p.try_clone();
+      fail_allocations = false;
+
+      REQUIRE(!copied);
+      REQUIRE(DerivedType::object_count == objects);
+    }
+  }
+}
+
+#ifdef ISOCPP_P0201_POLYMORPHIC_VALUE_HAS_CONSTEXPR
+namespace {
+// Destructors are user-provided as GCC 12 rejects implicitly constexpr virtual
+// destructors in constant expressions.
+struct Rule {
+  constexpr virtual ~Rule() {}
+  constexpr virtual int apply(int x) const = 0;
+};
+
+struct AddRule : Rule {
+  int n_;
+  constexpr explicit AddRule(int n) : n_(n) {}
+  constexpr ~AddRule() override {}
+  constexpr int apply(int x) const override { return x + n_; }
+};
+
+struct ScaleRule : Rule {
+  int n_;
+  constexpr explicit ScaleRule(int n) : n_(n) {}
+  constexpr ~ScaleRule() override {}
+  constexpr int apply(int x) const override { return x * n_; }
+};
+
+constexpr int apply_rules() {
+  auto add = make_polymorphic_value<Rule, AddRule>(2);
+  polymorphic_value<Rule> scale(std::in_place_type<ScaleRule>, 3);
+
+  auto copied = add;
+  polymorphic_value<Rule> moved(std::move(scale));
+  copied = moved;
+
+  polymorphic_value<AddRule> derived(std::in_place_type<AddRule>, 1);
+  polymorphic_value<Rule> converted(derived);
+  polymorphic_value<Rule> move_converted(std::move(derived));
+  auto converted_copy = converted;
+
+  return add->apply(1) + copied->apply(2) + converted_copy->apply(3) +
+         (scale ? 100 : 0) + (derived ? 100 : 0) +
+         (move_converted->apply(0) - 1);
+}
+}  // namespace
+
+TEST_CASE("polymorphic_value in constant expressions",
+          "[polymorphic_value.constexpr]") {
+  static_assert(apply_rules() == 3 + 6 + 4);
+  REQUIRE(apply_rules() == 3 + 6 + 4);
 }
+#endif